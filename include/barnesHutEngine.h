@@ -0,0 +1,65 @@
+#ifndef BARNES_HUT_ENGINE_H
+#define BARNES_HUT_ENGINE_H
+
+#include <nbody.h>
+#include <threadPool.h>
+
+// One cube of the octree. Nodes are stored depth first, so the first child of an
+// inner node is the next node and next skips past the whole subtree.
+struct OctreeNode
+{
+    float centerX, centerY, centerZ; // center of mass
+    float mass;
+    float boxX, boxY, boxZ; // geometric center of the cube
+    float size;             // edge length of the cube
+    float quad[6];          // traceless quadrupole about the center of mass: xx, yy, zz, xy, xz, yz
+    int begin, end;         // range of bodies in tree order
+    int next;               // node after this subtree
+    bool leaf;
+};
+
+// Octree shared by the tree based engines, bodies are kept sorted in tree order
+class Octree
+{
+public:
+    void build(const std::vector<Particle> &particles, int leafSize);
+
+    std::vector<OctreeNode> nodes;
+    std::vector<int> order; // tree order -> particle index
+    std::vector<float> x, y, z, mass;
+
+    float rootCenter[3];
+    float rootSize;
+
+private:
+    void buildNode(int begin, int end, float cx, float cy, float cz, float half, int depth);
+    void computeMoments(int node);
+
+    int leafSize;
+    std::vector<int> scratch;
+};
+
+// Barnes-Hut tree code. A node is used as a whole when size / distance < theta.
+class BarnesHutEngine : public NBodyEngine
+{
+public:
+    BarnesHutEngine(const EngineConfig &config);
+    const char *name() const { return engineName.c_str(); }
+    void computeAccelerations(const std::vector<Particle> &particles, std::vector<cy::Vec3f> &acc);
+    void computeActiveAccelerations(const std::vector<Particle> &particles, const std::vector<int> &active, std::vector<cy::Vec3f> &acc);
+
+private:
+    cy::Vec3f walk(int t, long long &evaluated) const;
+
+    std::string engineName;
+    ThreadPool pool;
+    float theta;
+    int leafSize;
+    bool quadrupole;
+    Octree tree;
+    std::vector<int> treePositions;  // particle index -> tree order
+    std::vector<int> activePositions;
+    std::vector<long long> threadInteractions;
+};
+
+#endif
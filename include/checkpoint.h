@@ -0,0 +1,66 @@
+#ifndef CHECKPOINT_H
+#define CHECKPOINT_H
+
+#include <nbody.h>
+#include <stdint.h>
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+
+const char CHECKPOINT_MAGIC[8] = {'N', 'B', 'O', 'D', 'Y', 'C', 'K', 'P'};
+const uint32_t CHECKPOINT_VERSION = 1;
+
+// Everything a run needs to carry on exactly where it stopped
+struct Checkpoint
+{
+    int64_t step = 0;
+    float dt = 0;
+    std::string integrator;              // name of the integrator integratorState belongs to
+    std::vector<char> integratorState;
+    std::string rngState;                // the generator written as text by operator<<
+    std::vector<Particle> initialParticles; // what the R key resets to
+    std::vector<Particle> particles;
+    std::vector<int> bodyIds;            // original body in each slot of particles
+};
+
+// Writes the whole checkpoint to path + ".tmp", syncs it to disk and renames it over path, so
+// a crash at any point leaves either the old checkpoint or the new one in place
+bool writeCheckpoint(const std::string &path, const Checkpoint &checkpoint);
+
+// Prints the reason and returns false if the file isn't a complete checkpoint
+bool readCheckpoint(const std::string &path, Checkpoint &checkpoint);
+
+// Writes checkpoints on a background thread so the simulation only pays for copying its state
+class CheckpointWriter
+{
+public:
+    CheckpointWriter(const std::string &path);
+    ~CheckpointWriter();
+
+    // Finishes the checkpoint in progress and stops taking new ones
+    void close();
+
+    // Takes the contents of checkpoint and returns at once. While the previous checkpoint is
+    // still being written the new one is dropped instead of queued, so returns false.
+    bool save(Checkpoint &checkpoint);
+
+    std::atomic<long long> written;
+    std::atomic<long long> dropped;
+
+private:
+    void writerLoop();
+
+    std::string path;
+    Checkpoint next;
+    bool busy = false;
+    bool stopping = false;
+    std::thread worker;
+    std::mutex mutex;
+    std::condition_variable wake;
+
+    CheckpointWriter(const CheckpointWriter &);
+    CheckpointWriter &operator=(const CheckpointWriter &);
+};
+
+#endif
@@ -0,0 +1,32 @@
+#ifndef FFT_H
+#define FFT_H
+
+#include <complex>
+#include <vector>
+#include <threadPool.h>
+
+typedef std::complex<float> Complex;
+
+// Radix-2 Cooley-Tukey transform of a cubic grid, n has to be a power of two.
+// Twiddles and the bit reversal table are built once per size.
+class Fft3d
+{
+public:
+    void plan(int n);
+    int size() const { return n; }
+
+    // In place, x fastest. The inverse is not scaled by 1/n^3.
+    void transform(Complex *grid, bool inverse, ThreadPool &pool);
+
+private:
+    void transformLine(Complex *line, bool inverse) const;
+
+    int n = 0;
+    std::vector<Complex> twiddles;
+    std::vector<int> reversed;
+    std::vector<std::vector<Complex> > scratch; // one line per thread
+};
+
+bool isPowerOfTwo(int n);
+
+#endif
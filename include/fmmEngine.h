@@ -0,0 +1,69 @@
+#ifndef FMM_ENGINE_H
+#define FMM_ENGINE_H
+
+#include <barnesHutEngine.h>
+
+// Index tables for Cartesian Taylor expansions, terms are the multi-indices k with |k| <= order
+struct ExpansionTables
+{
+public:
+    void build(int order);
+
+    // Monomials d^k for every term
+    void monomials(double dx, double dy, double dz, double *out) const;
+    // Taylor coefficients (1/k!) D^k (1/r) at d for every term
+    void derivatives(double dx, double dy, double dz, double *out) const;
+
+    struct Term
+    {
+        int x, y, z;
+        int degree;
+        int lower[3];  // term k - e_i, -1 when k_i == 0
+        int lower2[3]; // term k - 2e_i, -1 when k_i < 2
+    };
+
+    // out[target] += coefficient * in[source] * d^monomial
+    struct Product
+    {
+        int target, source, monomial;
+        double coefficient;
+    };
+
+    int order;
+    std::vector<Term> terms;
+    std::vector<Product> multipoleShift; // M2M
+    std::vector<Product> localShift;     // L2L
+    std::vector<Product> multipoleToLocal; // M2L, monomial indexes the derivative table
+
+private:
+    int index(int x, int y, int z) const;
+};
+
+// Fast multipole method on the Barnes-Hut octree: dual tree traversal with
+// Cartesian expansions of configurable order, cells interact when (rA + rB) < theta * distance
+class FmmEngine : public NBodyEngine
+{
+public:
+    FmmEngine(const EngineConfig &config);
+    const char *name() const { return engineName.c_str(); }
+    void computeAccelerations(const std::vector<Particle> &particles, std::vector<cy::Vec3f> &acc);
+
+private:
+    void upwardPass(int node);
+    void interact(int target, int source, long long &evaluated);
+    void downwardPass(int node);
+
+    std::string engineName;
+    ThreadPool pool;
+    float theta;
+    int leafSize;
+    ExpansionTables tables;
+    Octree tree;
+    std::vector<double> multipoles; // terms per node
+    std::vector<double> locals;     // terms per node
+    std::vector<float> radii;       // distance from the center of mass to the farthest body
+    std::vector<float> gx, gy, gz;  // field per body in tree order
+    std::vector<long long> threadInteractions;
+};
+
+#endif
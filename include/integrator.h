@@ -0,0 +1,140 @@
+#ifndef INTEGRATOR_H
+#define INTEGRATOR_H
+
+#include <nbody.h>
+
+// Position and velocity weights of the 4th order Yoshida composition, a leapfrog step of
+// (2 - 2^(1/3))^-1 dt, then -2^(1/3) (2 - 2^(1/3))^-1 dt, then the first again.
+// particle.comp runs the same sequence of drifts and kicks.
+const double YOSHIDA_DRIFT[4] = {0.6756035959798289, -0.1756035959798288, -0.1756035959798288, 0.6756035959798289};
+const double YOSHIDA_KICK[3] = {1.3512071919596578, -1.7024143839193153, 1.3512071919596578};
+
+// Advances the particles by one step using the forces from an engine
+class Integrator
+{
+public:
+    virtual ~Integrator() {}
+
+    virtual const char *name() const = 0;
+
+    virtual void step(NBodyEngine &engine, std::vector<Particle> &particles) = 0;
+
+    // Keeps the per body state with its body after the particles were permuted,
+    // permutation[slot] is the old slot of the body now in slot
+    virtual void permute(const std::vector<int> &/*permutation*/) {}
+
+    // Drops the saved forces, for when the particles were replaced
+    virtual void reset() {}
+
+    // Appends what the integrator carries from one step to the next, for checkpoints
+    virtual void save(std::vector<char> &/*state*/) const {}
+    // Takes back what save() wrote, false if it doesn't fit this integrator
+    virtual bool restore(const std::vector<char> &state) { return state.empty(); }
+
+    // Force evaluations of single bodies so far
+    long long bodyEvaluations = 0;
+};
+
+// The update from particle.comp: kick with the current force, then drift with the new velocity
+class EulerIntegrator : public Integrator
+{
+public:
+    EulerIntegrator(float dt) : dt(dt) {}
+    const char *name() const { return "euler"; }
+    void step(NBodyEngine &engine, std::vector<Particle> &particles);
+
+private:
+    float dt;
+    std::vector<cy::Vec3f> acc;
+};
+
+// Kick-drift-kick leapfrog. The closing half kick's forces open the next step, so it
+// costs one force evaluation per step like Euler but is symplectic and second order.
+class LeapfrogIntegrator : public Integrator
+{
+public:
+    LeapfrogIntegrator(float dt) : dt(dt) {}
+    const char *name() const { return "leapfrog"; }
+    void step(NBodyEngine &engine, std::vector<Particle> &particles);
+    void permute(const std::vector<int> &permutation);
+    void reset() { acc.clear(); }
+    void save(std::vector<char> &state) const;
+    bool restore(const std::vector<char> &state);
+
+private:
+    float dt;
+    std::vector<cy::Vec3f> acc;
+};
+
+// Yoshida's symplectic 4th order composition of three leapfrog steps, three force evaluations per step
+class YoshidaIntegrator : public Integrator
+{
+public:
+    YoshidaIntegrator(float dt) : dt(dt) {}
+    const char *name() const { return "yoshida"; }
+    void step(NBodyEngine &engine, std::vector<Particle> &particles);
+
+private:
+    float dt;
+    std::vector<cy::Vec3f> acc;
+};
+
+// 4th order Hermite predictor-corrector. Predicts from the acceleration and jerk, evaluates both
+// at the prediction and corrects, one (acceleration, jerk) evaluation per step.
+class HermiteIntegrator : public Integrator
+{
+public:
+    HermiteIntegrator(float dt) : dt(dt) {}
+    const char *name() const { return "hermite"; }
+    void step(NBodyEngine &engine, std::vector<Particle> &particles);
+    void permute(const std::vector<int> &permutation);
+    void reset() { acc.clear(); }
+    void save(std::vector<char> &state) const;
+    bool restore(const std::vector<char> &state);
+
+private:
+    float dt;
+    std::vector<cy::Vec3f> acc, jerk;
+    std::vector<cy::Vec3f> newAcc, newJerk;
+    std::vector<Particle> start;
+};
+
+// Power of two block time steps. One step advances dtMax in 2^maxLevel substeps and a body
+// on level L is kicked every 2^(maxLevel - L) substeps with its own dt = dtMax / 2^L, so only
+// the bodies due on a substep get their forces evaluated. Everything drifts every substep.
+// With maxLevel 0 and dtMax 1 this is exactly the Euler update from particle.comp.
+class BlockTimestepper : public Integrator
+{
+public:
+    // eta scales the per body step dt = eta * min(sqrt(eps / |a|), |a| / |jerk|)
+    BlockTimestepper(int maxLevel, float eta, float dtMax);
+
+    const char *name() const { return "block"; }
+    void step(NBodyEngine &engine, std::vector<Particle> &particles);
+    void permute(const std::vector<int> &permutation);
+    void reset() { levels.clear(); }
+    void save(std::vector<char> &state) const;
+    bool restore(const std::vector<char> &state);
+
+private:
+    int chooseLevel(const cy::Vec3f &acc, int body, int substep) const;
+
+    int maxLevel;
+    float eta;
+    float dtMax;
+    std::vector<int> levels;
+    std::vector<cy::Vec3f> previousAcc;
+    std::vector<float> previousDt; // 0 until the body has been evaluated once
+    std::vector<cy::Vec3f> acc;
+    std::vector<int> active;
+};
+
+// Picks "euler", "leapfrog", "yoshida" or "hermite", returns nullptr for anything else
+Integrator *createIntegrator(const std::string &name, float dt);
+
+// Kinetic plus potential energy of the update the shader integrates. Bodies have unit inertia
+// (the shader adds m_i m_j forces straight onto the velocity) and pairs closer than the
+// clamp feel a constant force, so the potential is linear inside it.
+double totalEnergy(const std::vector<Particle> &particles);
+
+#endif
@@ -0,0 +1,97 @@
+#ifndef NBODY_H
+#define NBODY_H
+
+#include <cyVector.h>
+#include <string>
+#include <vector>
+
+// Host copy of a body, the mass rides in the unused w lane of the position.
+// particleLayout.h packs these into whatever the shaders were generated against.
+struct Particle
+{
+public:
+    cy::Vec4f pos; // xyz position, w mass
+    cy::Vec4f vel;
+
+    float mass() const { return pos.w; }
+};
+
+// Constants from calcAcceleration() in particle.comp
+const float GRAVITY = 0.0000005f;
+const float MIN_DISTANCE_SQUARED = 0.01f;
+
+// Runtime options for picking and tuning an engine
+struct EngineConfig
+{
+    std::string engine = "reference";
+    std::string simd = "auto"; // kernel for the all-pairs engines: auto, avx512, avx2 or scalar
+    int threads = 0;           // worker threads for the parallel engines, 0 uses every hardware thread
+    int tileSize = 1024;       // bodies per cache tile in the tiled engine
+    std::string affinity = "none";
+    bool symmetric = false;    // tiled engine visits each pair once using Newton's third law
+    float theta = 0.5;         // opening angle of the tree engines
+    int leafSize = 16;         // most bodies in a tree leaf
+    bool quadrupole = false;   // add quadrupole moments to the barnes-hut nodes
+    int fmmOrder = 4;          // expansion order of the fmm engine
+    int meshSize = 64;         // cells per side of the particle-mesh grid, a power of two
+    std::string boundary = "isolated"; // particle-mesh boundary: isolated or periodic
+    float splitScale = 1.25;   // p3m long/short range split in mesh cells
+};
+
+// Anything that can advance the particle system on the host
+class NBodyEngine
+{
+public:
+    virtual ~NBodyEngine() {}
+
+    virtual const char *name() const = 0;
+
+    // Fills acc with the same per-particle acceleration calcAcceleration() returns
+    virtual void computeAccelerations(const std::vector<Particle> &particles, std::vector<cy::Vec3f> &acc) = 0;
+
+    // Same for the listed bodies only, everything else in acc is left alone.
+    // Engines that can't save work by skipping bodies evaluate all of them.
+    virtual void computeActiveAccelerations(const std::vector<Particle> &particles, const std::vector<int> &active, std::vector<cy::Vec3f> &acc);
+
+    // Accelerations and their time derivatives for the hermite integrator. The jerk needs
+    // every pair's relative velocity, so the default is a direct sum whatever the engine.
+    virtual void computeAccelerationsAndJerks(const std::vector<Particle> &particles, std::vector<cy::Vec3f> &acc, std::vector<cy::Vec3f> &jerk);
+
+    // Advances the particles one step with the Euler update from particle.comp's main()
+    virtual void step(std::vector<Particle> &particles);
+
+    // Pairwise interactions evaluated since construction
+    long long interactions = 0;
+
+protected:
+    // One body's term of the direct sum behind computeAccelerationsAndJerks()
+    void calcAccelerationAndJerk(const std::vector<Particle> &particles, int id, cy::Vec3f &acc, cy::Vec3f &jerk) const;
+
+    std::vector<cy::Vec3f> accelerations;
+    std::vector<cy::Vec3f> activeScratch;
+};
+
+// Straight port of particle.comp, every engine is validated against this one
+class ReferenceEngine : public NBodyEngine
+{
+public:
+    const char *name() const { return "reference"; }
+    void computeAccelerations(const std::vector<Particle> &particles, std::vector<cy::Vec3f> &acc);
+    void computeActiveAccelerations(const std::vector<Particle> &particles, const std::vector<int> &active, std::vector<cy::Vec3f> &acc);
+
+private:
+    cy::Vec3f calcAcceleration(const std::vector<Particle> &particles, int id) const;
+};
+
+// Relative acceleration error of an engine against a reference result
+struct AccelerationError
+{
+    float max;
+    float rms;
+};
+AccelerationError compareAccelerations(const std::vector<cy::Vec3f> &acc, const std::vector<cy::Vec3f> &reference);
+
+// Returns nullptr if the config names an engine that doesn't run on the host
+NBodyEngine *createEngine(const EngineConfig &config);
+
+#endif
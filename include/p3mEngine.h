@@ -0,0 +1,28 @@
+#ifndef P3M_ENGINE_H
+#define P3M_ENGINE_H
+
+#include <pmEngine.h>
+
+// Particle-particle particle-mesh: the mesh carries the erf(r / 2s) / r long range part and
+// pairs closer than the cutoff add the rest directly through a cell linked list, so close
+// encounters keep the shader's r^2 clamp.
+class P3mEngine : public PmEngine
+{
+public:
+    P3mEngine(const EngineConfig &config);
+    void computeAccelerations(const std::vector<Particle> &particles, std::vector<cy::Vec3f> &acc);
+
+private:
+    void binBodies(const std::vector<Particle> &particles, float cutoff);
+
+    // linked cells, bodies are sorted by cell
+    int cellCounts[3];
+    float cellOrigin[3];
+    float cellWidth;
+    std::vector<int> cellStart; // first sorted body of each cell, one extra at the end
+    std::vector<int> order;     // sorted -> particle index
+    std::vector<float> x, y, z, mass;
+    std::vector<long long> threadInteractions;
+};
+
+#endif
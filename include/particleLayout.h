@@ -0,0 +1,58 @@
+#ifndef PARTICLE_LAYOUT_H
+#define PARTICLE_LAYOUT_H
+
+#include <nbody.h>
+
+// The original shader body with a double mass, 48 bytes
+struct WideParticle
+{
+public:
+    cy::Vec4f pos;
+    cy::Vec4f vel;
+    double mass;
+    double padding;
+};
+
+// How the particles are stored in the shader storage buffers. "compact" keeps pos.xyz and the
+// mass in one vec4 and the velocities in a second buffer, so the force loop and particle.vert
+// only pull 16 bytes per body. "wide" is one WideParticle per body.
+//
+// Shaders don't declare the particle buffers, their "#pragma particle_layout" line is replaced
+// with source(), which declares them for the selected layout along with these accessors:
+//   vec3 inputPos(uint i), vec3 inputVel(uint i), float inputMass(uint i)    bindings 0 and 3
+//   vec3 outputPos(uint i), vec3 outputVel(uint i), float outputMass(uint i) bindings 1 and 4
+//   storePos(uint i, vec3), storeVel(uint i, vec3), storeMass(uint i, float) bindings 1 and 4
+// Bindings 3 and 4 hold the velocities and are only used by the compact layout.
+class ParticleLayout
+{
+public:
+    // Returns false for anything but "compact" or "wide"
+    bool select(const std::string &name);
+
+    bool isCompact() const { return compact; }
+
+    // Bytes per body in the body buffers and the velocity buffers, 0 when there are no velocity buffers
+    size_t bodyStride() const;
+    size_t velocityStride() const;
+
+    std::string source() const;
+
+    // Replaces the pragma line of a shader with source()
+    std::string inject(const std::string &shader) const;
+
+    // Converts particles into buffer contents, the pointers stay valid until the next pack
+    void pack(const std::vector<Particle> &particles);
+    const void *bodies() const;
+    const void *velocities() const;
+
+    // Reads buffer contents back into particles, which must already have the right size
+    void unpack(const void *bodies, const void *velocities, std::vector<Particle> &particles) const;
+
+private:
+    bool compact = true;
+    std::vector<cy::Vec4f> compactBodies;
+    std::vector<cy::Vec4f> compactVelocities;
+    std::vector<WideParticle> wideBodies;
+};
+
+#endif
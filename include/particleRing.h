@@ -0,0 +1,70 @@
+#ifndef PARTICLE_RING_H
+#define PARTICLE_RING_H
+
+#include <GL/glew.h>
+#include <particleLayout.h>
+
+const int RING_SIZE = 3;
+// half float position, RGBA8 color and an 8 bit size, see STAGE_PACK in particle.comp
+const int RENDER_STREAM_STRIDE = 12;
+
+// Three generations of the particle buffers, each persistently mapped. The compute shader
+// writes the next generation while the renderer draws the current one and the host reads
+// or writes an older one. A fence after the last command touching a generation tells the
+// host when it may access that generation's mapping.
+class ParticleRing
+{
+public:
+    ParticleRing() {}
+
+    // Allocates every generation for the particles and fills them all with the particles
+    void init(ParticleLayout *layout, const std::vector<Particle> &particles);
+
+    // Newest complete generation, the one to draw and to read from
+    int current() const { return currentGeneration; }
+    int next() const { return (currentGeneration + 1) % RING_SIZE; }
+    // Makes the next generation current once its commands have been issued
+    void advance() { currentGeneration = next(); }
+
+    GLuint bodyBuffer(int generation) const { return bodies[generation]; }
+    // Same as bodyBuffer() in the wide layout, which keeps the velocities with the bodies
+    GLuint velocityBuffer(int generation) const;
+
+    // Adds a render stream to every generation, filled on the gpu by STAGE_PACK
+    void initRenderStreams();
+    GLuint renderStream(int generation) const { return streams[generation]; }
+
+    // Binds a generation to the input (0, 3) or output (1, 4) bindings of the particle layout
+    void bindInput(int generation) const;
+    void bindOutput(int generation) const;
+
+    // Copies one generation into another on the gpu
+    void copy(int source, int target) const;
+
+    // Marks the generation as used by every command issued so far
+    void fence(int generation);
+    // Returns once the gpu is done with the generation
+    void wait(int generation);
+    // True when waiting on the generation would not block
+    bool ready(int generation);
+
+    // Host access through the mappings, both wait for the generation first
+    void write(int generation, const std::vector<Particle> &particles);
+    void read(int generation, std::vector<Particle> &particles);
+
+private:
+    ParticleLayout *layout = nullptr;
+    int count = 0;
+    int currentGeneration = 0;
+    GLuint bodies[RING_SIZE] = {};
+    GLuint velocities[RING_SIZE] = {};
+    void *mappedBodies[RING_SIZE] = {};
+    void *mappedVelocities[RING_SIZE] = {};
+    GLsync fences[RING_SIZE] = {};
+    GLuint streams[RING_SIZE] = {};
+
+    ParticleRing(const ParticleRing &);
+    ParticleRing &operator=(const ParticleRing &);
+};
+
+#endif
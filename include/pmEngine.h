@@ -0,0 +1,48 @@
+#ifndef PM_ENGINE_H
+#define PM_ENGINE_H
+
+#include <nbody.h>
+#include <fft.h>
+
+// Particle-mesh solver: cloud-in-cell deposit, FFT Poisson solve, finite difference
+// gradient and cloud-in-cell interpolation back to the bodies.
+// The isolated boundary zero pads the mesh to twice its size and convolves with 1/r,
+// the periodic one wraps the bounding box and divides by the discrete Laplacian.
+class PmEngine : public NBodyEngine
+{
+public:
+    PmEngine(const EngineConfig &config);
+    const char *name() const { return engineName.c_str(); }
+    void computeAccelerations(const std::vector<Particle> &particles, std::vector<cy::Vec3f> &acc);
+
+protected:
+    // Fills meshX/Y/Z with the mesh field at every body, without the G * m_i factor
+    void computeMeshField(const std::vector<Particle> &particles);
+
+    // Scale in cells of the gaussian that splits long and short range forces, 0 for pure PM
+    float splitScale = 0;
+
+    std::string engineName;
+    ThreadPool pool;
+    int meshSize;
+    bool isolated;
+    float cellSize;
+    float origin[3];
+    std::vector<float> meshX, meshY, meshZ;
+
+private:
+    void buildKernel();
+    void depositMass(const std::vector<Particle> &particles);
+    void solvePotential();
+    void interpolateField(const std::vector<Particle> &particles);
+
+    int paddedSize;
+    Fft3d fft;
+    std::vector<Complex> grid;
+    std::vector<Complex> kernel; // transformed green's function for a unit cell
+    std::vector<std::vector<float> > threadMass;
+    std::vector<float> potential;
+    std::vector<float> fieldX, fieldY, fieldZ;
+};
+
+#endif
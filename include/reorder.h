@@ -0,0 +1,38 @@
+#ifndef REORDER_H
+#define REORDER_H
+
+#include <nbody.h>
+#include <threadPool.h>
+#include <stdint.h>
+
+// 63 bit keys, 21 bits per axis
+uint64_t mortonKey(uint32_t x, uint32_t y, uint32_t z);
+uint64_t hilbertKey(uint32_t x, uint32_t y, uint32_t z);
+
+// Stable parallel LSD radix sort of (key, value) pairs on 8 bit digits
+void radixSort(std::vector<uint64_t> &keys, std::vector<int> &values, ThreadPool &pool);
+
+// Sorts the particles along a space filling curve so bodies close in space are close in
+// memory. bodyIds follows the permutation: bodyIds[slot] is the original index of the body
+// now stored in slot, which is what rendering and outputs use to find a body.
+class SpatialReorder
+{
+public:
+    // curve is "morton" or "hilbert"
+    SpatialReorder(const std::string &curve, int threads);
+
+    void apply(std::vector<Particle> &particles, std::vector<int> &bodyIds);
+
+    // old slot of the body in each slot after the last apply, for anything else indexed by slot
+    const std::vector<int> &lastPermutation() const { return permutation; }
+
+private:
+    ThreadPool pool;
+    bool hilbert;
+    std::vector<uint64_t> keys;
+    std::vector<int> permutation;
+    std::vector<Particle> scratch;
+    std::vector<int> idScratch;
+};
+
+#endif
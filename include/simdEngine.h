@@ -0,0 +1,69 @@
+#ifndef SIMD_ENGINE_H
+#define SIMD_ENGINE_H
+
+#include <nbody.h>
+
+// Widest kernel we have, every array is padded to a multiple of this
+const int SIMD_WIDTH = 16;
+
+// Structure-of-arrays copy of the positions and masses, aligned and padded with massless bodies
+struct ParticleArrays
+{
+public:
+    ParticleArrays() {}
+    ~ParticleArrays();
+
+    // Copies particles in, growing the arrays if needed
+    void load(const std::vector<Particle> &particles);
+
+    float *x = nullptr;
+    float *y = nullptr;
+    float *z = nullptr;
+    float *mass = nullptr;
+    int count = 0;
+    int paddedCount = 0;
+
+private:
+    int capacity = 0;
+    ParticleArrays(const ParticleArrays &);
+    ParticleArrays &operator=(const ParticleArrays &);
+};
+
+// Adds sum(m_j * delta / (max(r2, 0.01) * r)) for bodies [jBegin, jEnd) onto bodies [iBegin, iEnd).
+// The G * m_i factor is left to the caller. jBegin and jEnd must be multiples of SIMD_WIDTH.
+typedef void (*PairKernel)(const ParticleArrays &bodies, int iBegin, int iEnd, int jBegin, int jEnd, float *ax, float *ay, float *az);
+
+// Newton's third law version: each unordered pair is visited once and m_i * m_j * delta * scale
+// is added to body i and subtracted from body j. With diagonal set both ranges are the same
+// tile and only pairs with j > i are visited. The G factor is left to the caller.
+typedef void (*SymmetricKernel)(const ParticleArrays &bodies, int iBegin, int iEnd, int jBegin, int jEnd, bool diagonal, float *fx, float *fy, float *fz);
+
+struct PairKernelInfo
+{
+    const char *name;
+    PairKernel kernel;
+    SymmetricKernel symmetric;
+};
+
+// Picks "avx512", "avx2" or "scalar", "auto" takes the widest one the cpu supports
+PairKernelInfo selectPairKernel(const std::string &simd);
+
+// All-pairs engine running the vectorized kernel on a single core
+class SimdEngine : public NBodyEngine
+{
+public:
+    SimdEngine(const EngineConfig &config);
+    const char *name() const { return engineName.c_str(); }
+    void computeAccelerations(const std::vector<Particle> &particles, std::vector<cy::Vec3f> &acc);
+    void computeActiveAccelerations(const std::vector<Particle> &particles, const std::vector<int> &active, std::vector<cy::Vec3f> &acc);
+
+private:
+    std::string engineName;
+    PairKernelInfo kernel;
+    ParticleArrays bodies;
+    std::vector<float> ax;
+    std::vector<float> ay;
+    std::vector<float> az;
+};
+
+#endif
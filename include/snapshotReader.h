@@ -0,0 +1,107 @@
+#ifndef SNAPSHOT_READER_H
+#define SNAPSHOT_READER_H
+
+#include <GL/glew.h>
+#include <particleLayout.h>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+
+struct Checkpoint;
+
+// Particle state of one step handed to the host
+struct Snapshot
+{
+public:
+    int step;
+    int latency; // frames between the request and the copy landing on the host
+    std::vector<Particle> particles;
+    std::vector<int> bodyIds; // original body in each slot, empty when the bodies never moved
+    // host state captured with the request when a checkpoint is due, still missing the particles
+    std::shared_ptr<Checkpoint> checkpoint;
+};
+
+// Staging copies in flight at once, a request is dropped when all of them are busy.
+// Also the most snapshots left waiting for the consumer, a slow consumer drops the newer ones.
+const int STAGING_SLOTS = 3;
+
+// Asynchronous gpu to host readback. A request copies a particle generation into a persistently
+// mapped staging buffer and fences it, poll() picks up the copies the gpu has finished without
+// ever waiting on one, and a consumer thread unpacks them and runs the callback.
+class SnapshotReader
+{
+public:
+    SnapshotReader(ParticleLayout *layout, int count, const std::function<void(const Snapshot &)> &consumer);
+    // Finishes the snapshots already handed over, then stops the consumer thread
+    ~SnapshotReader();
+
+    // Queues a copy of the buffers, returns false when every staging slot is still in flight.
+    // A checkpoint travels with the copy and reaches the consumer in its snapshot.
+    bool request(GLuint bodyBuffer, GLuint velocityBuffer, int step, long long frame, const std::vector<int> &bodyIds,
+                 const std::shared_ptr<Checkpoint> &checkpoint = nullptr);
+
+    // Forgets every snapshot the consumer hasn't started on, for when the run is reset under them
+    void discard();
+
+    // Call once per frame on the GL thread
+    void poll(long long frame);
+
+    // Hands particles that are already on the host, from a cpu engine, straight to the consumer thread.
+    // Dropped without copying them when the consumer is behind.
+    void deliver(int step, const std::vector<Particle> &particles, const std::vector<int> &bodyIds);
+
+    long long delivered = 0;
+    long long dropped = 0;
+    long long totalLatency = 0;
+    int maxLatency = 0;
+
+private:
+    struct Staging
+    {
+        GLuint bodies = 0;
+        GLuint velocities = 0;
+        void *mappedBodies = nullptr;
+        void *mappedVelocities = nullptr;
+        GLsync fence = 0;
+        int step = 0;
+        long long frame = 0;
+        std::vector<int> bodyIds;
+        std::shared_ptr<Checkpoint> checkpoint;
+    };
+
+    // Raw buffer contents waiting for the consumer thread, or host particles when bodies is empty
+    struct Pending
+    {
+        int step;
+        int latency;
+        std::vector<unsigned char> bodies;
+        std::vector<unsigned char> velocities;
+        std::vector<Particle> particles;
+        std::vector<int> bodyIds;
+        std::shared_ptr<Checkpoint> checkpoint;
+    };
+
+    bool backlogFull();
+    void consumerLoop();
+
+    ParticleLayout *layout;
+    int count;
+    std::function<void(const Snapshot &)> consumer;
+    Staging slots[STAGING_SLOTS]; // used round robin so copies finish in request order
+    int oldest = 0;
+    int inFlight = 0;
+
+    std::thread worker;
+    std::mutex mutex;
+    std::condition_variable wake;
+    std::deque<Pending> pending;
+    bool stopping = false;
+
+    SnapshotReader(const SnapshotReader &);
+    SnapshotReader &operator=(const SnapshotReader &);
+};
+
+#endif
@@ -0,0 +1,44 @@
+#ifndef THREAD_POOL_H
+#define THREAD_POOL_H
+
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Persistent workers that stay parked between steps instead of being spawned per step
+class ThreadPool
+{
+public:
+    // threadCount 0 uses every hardware thread, affinity is "none" or "compact" (worker n on cpu n,
+    // the calling thread is never pinned)
+    ThreadPool(int threadCount, const std::string &affinity);
+    ~ThreadPool();
+
+    int size() const { return threadCount; }
+
+    // Runs task(index, thread) for every index in [0, taskCount) and waits for all of them.
+    // The calling thread works as thread 0, so thread is always below size().
+    void parallelFor(int taskCount, const std::function<void(int, int)> &task);
+
+private:
+    void workerLoop(int thread);
+    void runTasks(int thread);
+
+    int threadCount;
+    std::vector<std::thread> workers;
+    std::mutex mutex;
+    std::condition_variable wake;
+    std::condition_variable done;
+    const std::function<void(int, int)> *currentTask = nullptr;
+    int taskCount = 0;
+    std::atomic<int> nextTask;
+    int generation = 0;
+    int busyWorkers = 0;
+    bool stopping = false;
+};
+
+#endif
@@ -0,0 +1,35 @@
+#ifndef TILED_ENGINE_H
+#define TILED_ENGINE_H
+
+#include <simdEngine.h>
+#include <threadPool.h>
+
+// Multithreaded all-pairs engine. Each task owns one tile of i-bodies and streams every
+// j-tile past it, so a j-tile loaded into L1/L2 is reused by the whole i-tile.
+// In symmetric mode each task is a pair of tiles evaluated once with Newton's third law
+// into per-thread force buffers that are summed at the end of the step.
+class TiledEngine : public NBodyEngine
+{
+public:
+    TiledEngine(const EngineConfig &config);
+    const char *name() const { return engineName.c_str(); }
+    void computeAccelerations(const std::vector<Particle> &particles, std::vector<cy::Vec3f> &acc);
+    void computeActiveAccelerations(const std::vector<Particle> &particles, const std::vector<int> &active, std::vector<cy::Vec3f> &acc);
+    void computeAccelerationsAndJerks(const std::vector<Particle> &particles, std::vector<cy::Vec3f> &acc, std::vector<cy::Vec3f> &jerk);
+
+private:
+    void computeSymmetric(std::vector<cy::Vec3f> &acc);
+
+    std::string engineName;
+    PairKernelInfo kernel;
+    ThreadPool pool;
+    int tileSize;
+    bool symmetric;
+    std::vector<std::vector<float> > threadForces; // x, y and z blocks of paddedCount each
+    ParticleArrays bodies;
+    std::vector<float> ax;
+    std::vector<float> ay;
+    std::vector<float> az;
+};
+
+#endif
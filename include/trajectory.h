@@ -0,0 +1,293 @@
+#ifndef TRAJECTORY_H
+#define TRAJECTORY_H
+
+#include <nbody.h>
+#include <threadPool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <thread>
+
+// Raw trajectory files are a header followed by fixed size frames, so frame k starts at
+// headerBytes + k * frameBytes. A frame is a 64 byte frame header and then one float array per
+// field with bodies in their original order. Arrays are 64 byte aligned and frames are page
+// aligned, so a mapped file can be used in place and any frame is one multiply away.
+const char TRAJECTORY_MAGIC[8] = {'N', 'B', 'O', 'D', 'Y', 'T', 'R', 'J'};
+const uint32_t TRAJECTORY_VERSION = 1;
+const size_t TRAJECTORY_PAGE = 4096;
+const size_t TRAJECTORY_ARRAY_ALIGNMENT = 64;
+
+// Compressed trajectory files are a header followed by chunks of consecutive frames. Each chunk
+// is deflated on its own and starts from a plain frame, so reading a frame only ever decodes the
+// chunk it is in. Fields marked lossy are stored as integers on a grid fine enough to keep every
+// value within the error bound.
+const char COMPRESSED_TRAJECTORY_MAGIC[8] = {'N', 'B', 'O', 'D', 'Y', 'T', 'R', 'Z'};
+const uint32_t COMPRESSED_TRAJECTORY_VERSION = 1;
+
+enum TrajectoryField
+{
+    FIELD_X,
+    FIELD_Y,
+    FIELD_Z,
+    FIELD_VX,
+    FIELD_VY,
+    FIELD_VZ,
+    FIELD_MASS,
+    FIELD_COUNT
+};
+
+struct TrajectoryHeader
+{
+    char magic[8];
+    uint32_t version;
+    uint32_t bodyCount;
+    uint32_t fieldCount;
+    uint32_t fieldBytes; // bytes of one field array including its padding
+    uint64_t headerBytes;
+    uint64_t frameBytes;
+    float dt;            // time one step covers
+    uint32_t reserved[7];
+};
+
+struct TrajectoryFrameHeader
+{
+    int64_t step;
+    int64_t reserved[7];
+};
+
+struct CompressedTrajectoryHeader
+{
+    char magic[8];
+    uint32_t version;
+    uint32_t bodyCount;
+    uint32_t fieldCount;
+    uint32_t chunkFrames; // frames in every chunk but the last
+    float dt;
+    uint32_t lossyFields; // bit per TrajectoryField, 0 keeps every float exact
+    float errorBound;     // largest error of a lossy field as a fraction of its bounding box
+    uint32_t reserved[7];
+};
+
+// Followed by the step of each frame, a ChunkQuantization per field when the file has lossy
+// fields, and then compressedBytes of zlib data
+struct CompressedChunkHeader
+{
+    uint32_t frameCount;
+    uint32_t reserved;
+    uint64_t compressedBytes;
+};
+
+// Grid of a lossy field in one chunk, value = origin + q * quantum
+struct ChunkQuantization
+{
+    float origin;
+    float quantum;
+};
+
+// Fields that are stored together and share a bounding box
+enum TrajectoryFieldGroup
+{
+    GROUP_POSITION,
+    GROUP_VELOCITY,
+    GROUP_MASS,
+    GROUP_COUNT
+};
+
+TrajectoryFieldGroup fieldGroup(int field);
+
+// How recorded trajectories are stored
+struct TrajectoryConfig
+{
+    std::string format = "raw"; // raw (mappable) or deflate
+    int chunkFrames = 64;       // frames compressed together, the unit a deflate trajectory seeks by
+    int threads = 0;            // compression workers, 0 uses every hardware thread
+    uint32_t lossyFields = 0;   // bit per TrajectoryField quantized in deflate trajectories
+    float errorBound = 1e-4;    // largest error of a lossy field as a fraction of its bounding box
+};
+
+// Turns a list like "position,velocity" into lossyFields bits, returns false for unknown names
+bool parseFieldGroups(const std::string &list, uint32_t &fields);
+
+// One frame on its way to the file, fields are bodyCount floats each in the order of TrajectoryField
+struct TrajectoryFrame
+{
+    int64_t step;
+    std::vector<float> fields;
+};
+
+// Receives frames from the simulation loop, encoding and file writes happen on a background thread
+class TrajectoryWriter
+{
+public:
+    virtual ~TrajectoryWriter();
+
+    bool isOpen() const { return file != nullptr; }
+
+    // Copies the particles into a frame and returns, bodyIds gives the original body of
+    // each slot and may be empty when the slots were never permuted
+    void append(int step, const std::vector<Particle> &particles, const std::vector<int> &bodyIds);
+
+    // Writes out every frame appended so far and closes the file, later frames are ignored
+    void close();
+
+    long long framesWritten() const { return framesDone; }
+    // Bytes the file takes and the frames in it would take as plain floats
+    long long bytesWritten() const { return bytesDone; }
+    long long rawBytes() const { return framesDone * FIELD_COUNT * bodyCount * (long long)sizeof(float); }
+
+protected:
+    TrajectoryWriter(const std::string &path, int bodyCount);
+
+    // Call at the end of the subclass constructor once the file header is written
+    void start();
+
+    // Run on the background thread, frames arrive in order
+    virtual void write(std::vector<TrajectoryFrame> &frames) = 0;
+    // Run on the background thread after the last frame
+    virtual void flush() {}
+
+    void writeBytes(const void *data, size_t bytes);
+
+    FILE *file = nullptr;
+    int bodyCount;
+    std::atomic<long long> framesDone;
+    std::atomic<long long> bytesDone;
+
+private:
+    void writerLoop();
+
+    std::thread worker;
+    std::mutex mutex;
+    std::condition_variable wake;
+    std::deque<TrajectoryFrame> pending;
+    bool stopping = false;
+
+    TrajectoryWriter(const TrajectoryWriter &);
+    TrajectoryWriter &operator=(const TrajectoryWriter &);
+};
+
+// Writes the fixed stride format TrajectoryFile maps
+class RawTrajectoryWriter : public TrajectoryWriter
+{
+public:
+    RawTrajectoryWriter(const std::string &path, int bodyCount, float dt);
+    ~RawTrajectoryWriter();
+
+protected:
+    void write(std::vector<TrajectoryFrame> &frames);
+
+private:
+    TrajectoryHeader header;
+    std::vector<unsigned char> frameBuffer;
+};
+
+// Writes chunks of chunkFrames frames. Within a chunk every float is stored as the difference of
+// its bits from a straight line through the two frames before, which leaves the high bytes zero,
+// and each field array is split into byte planes so those zeros line up for deflate. Full chunks
+// are compressed in parallel on a pool of threads, the data stays bit exact.
+// Lossy fields go through the same steps as integers on a grid of twice the error bound, scaled
+// to the field group's bounding box over the chunk, and every frame's compression ratio and
+// largest error is printed.
+class CompressedTrajectoryWriter : public TrajectoryWriter
+{
+public:
+    CompressedTrajectoryWriter(const std::string &path, int bodyCount, float dt, const TrajectoryConfig &config);
+    ~CompressedTrajectoryWriter();
+
+protected:
+    void write(std::vector<TrajectoryFrame> &frames);
+    void flush();
+
+private:
+    void writeChunks(bool partial);
+
+    CompressedTrajectoryHeader header;
+    ThreadPool pool;
+    std::vector<TrajectoryFrame> chunkFrames; // frames not yet in a written chunk
+};
+
+// Picks the writer for config.format, returns nullptr for unknown formats
+TrajectoryWriter *createTrajectoryWriter(const TrajectoryConfig &config, const std::string &path, int bodyCount, float dt);
+
+// Read only memory mapping of a raw trajectory file
+class TrajectoryFile
+{
+public:
+    TrajectoryFile() {}
+    ~TrajectoryFile();
+
+    // Prints the reason and returns false if the file can't be used
+    bool open(const std::string &path);
+
+    int bodyCount() const { return header->bodyCount; }
+    float dt() const { return header->dt; }
+    // Frames completely on disk, a run that was cut short still has all but its last frame
+    long long frameCount() const { return frames; }
+
+    int64_t step(long long frame) const;
+    // Points straight into the mapping, bodyCount() floats
+    const float *field(long long frame, TrajectoryField field) const;
+
+    void readFrame(long long frame, std::vector<Particle> &particles) const;
+
+private:
+    void close();
+
+    const unsigned char *data = nullptr;
+    size_t size = 0;
+    const TrajectoryHeader *header = nullptr;
+    long long frames = 0;
+#ifdef _WIN32
+    void *fileHandle = nullptr;
+    void *mappingHandle = nullptr;
+#endif
+
+    TrajectoryFile(const TrajectoryFile &);
+    TrajectoryFile &operator=(const TrajectoryFile &);
+};
+
+// Reader for compressed trajectories, seeks straight to the chunk holding a frame and keeps the
+// last decoded chunk so walking through frames in order decompresses each chunk once
+class CompressedTrajectoryFile
+{
+public:
+    CompressedTrajectoryFile() {}
+    ~CompressedTrajectoryFile();
+
+    // Indexes the chunks, prints the reason and returns false if the file can't be used
+    bool open(const std::string &path);
+
+    int bodyCount() const { return header.bodyCount; }
+    float dt() const { return header.dt; }
+    long long frameCount() const { return frames; }
+    long long chunkCount() const { return chunkOffsets.size(); }
+
+    int64_t step(long long frame) const;
+
+    // Returns false if the chunk holding the frame is damaged
+    bool readFrame(long long frame, std::vector<Particle> &particles);
+
+private:
+    bool decodeChunk(long long chunk);
+    size_t gridBytes() const { return header.lossyFields != 0 ? sizeof(ChunkQuantization) * FIELD_COUNT : 0; }
+
+    FILE *file = nullptr;
+    CompressedTrajectoryHeader header;
+    long long frames = 0;
+    std::vector<long long> chunkOffsets; // file offset of each chunk header
+    std::vector<int64_t> steps;
+    long long decodedChunk = -1;
+    std::vector<float> decoded; // fields of every frame of decodedChunk
+
+    CompressedTrajectoryFile(const CompressedTrajectoryFile &);
+    CompressedTrajectoryFile &operator=(const CompressedTrajectoryFile &);
+};
+
+// Reads one frame of either format, negative frames count back from the last one.
+// Prints the reason and returns false if there is no such frame.
+bool readTrajectoryFrame(const std::string &path, long long frame, std::vector<Particle> &particles, int64_t &step);
+
+#endif
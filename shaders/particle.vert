@@ -1,28 +1,125 @@
 #version 430 core
 #define PI 3.14159265358
 
-layout(location = 0) in int index;
+#pragma particle_layout
 
-struct Particle {
-    vec4 pos;
-    vec4 vel;
-    double mass;
-    double padding;
+// slot of each body, read only when the bodies were moved out of their original order
+layout(std430, binding = 5) readonly buffer bodySlotBuffer{
+    int bodySlots[];
 };
-
-layout(std430, binding = 1) buffer particleInputBuffer{
-    Particle particles[];
-} inBuffer;
+uniform bool permuted;
+#ifdef CULLED
+// slots cull.comp kept, the draw command picks the billboards or the points
+layout(std430, binding = 6) readonly buffer visibleBuffer{
+    uint visible[];
+};
+#endif
+#ifdef PACKED_STREAM
+// the render streams STAGE_PACK of particle.comp wrote for the current and the previous step
+layout(std430, binding = 10) readonly buffer renderStreamBuffer{
+    uint renderStream[];
+};
+layout(std430, binding = 11) readonly buffer previousStreamBuffer{
+    uint previousStream[];
+};
+uniform float maxSize; // billboard size the largest size byte stands for
+#endif
 
 uniform float maxVelocity;
+// the input bindings hold the step before the output ones, drawn alpha of the way between them
+uniform int interpolation; // 0 none, 1 linear, 2 cubic hermite
+uniform float alpha;
+uniform float stepTime;    // time between the two steps
+
+// BILLBOARD_QUADS and BILLBOARD_POINTS build the billboard here instead of in particle.geom
+// and LOD_POINTS draws the bodies cull.comp found too small for one as single pixels
+#if defined(BILLBOARD_QUADS) || defined(BILLBOARD_POINTS) || defined(LOD_POINTS)
+uniform mat4 viewMatrix;
+uniform mat3 rotationMatrix;
+uniform vec2 viewport;    // framebuffer size in pixels
+uniform float pixelScale; // pixels a unit spans at a clip w of 1
+#endif
 
 out vec3 vColor;
-out float vMass;
+#if defined(BILLBOARD_QUADS)
+out vec2 vCorner;
+#elif defined(LOD_POINTS)
+out float vCoverage;
+#elif !defined(BILLBOARD_POINTS)
+out float vSize;
+#endif
+
+#ifdef PACKED_STREAM
+vec3 streamPos(uint word0, uint word1){
+    return vec3(unpackHalf2x16(word0), unpackHalf2x16(word1).x);
+}
+#endif
 
 void main(){
-    gl_Position = vec4(inBuffer.particles[index].pos.xyz, 1);
-    vMass = float(inBuffer.particles[index].mass);
+#ifdef BILLBOARD_QUADS
+    // an instance per body, a vertex per corner
+    int body = gl_InstanceID;
+#else
+    int body = gl_VertexID;
+#endif
+#ifdef CULLED
+    int index = int(visible[body]);
+#else
+    int index = permuted ? bodySlots[body] : body;
+#endif
+
+#ifdef PACKED_STREAM
+    // twelve bytes with the color and size worked out once per step, the stream has no
+    // velocities so hermite interpolation falls back to linear
+    uint word1 = renderStream[3*index + 1];
+    vec3 position = streamPos(renderStream[3*index], word1);
+    vColor = unpackUnorm4x8(renderStream[3*index + 2]).rgb;
+    float size = float((word1 >> 16) & 0xffu)/255*maxSize;
+    if (interpolation != 0) {
+        position = mix(streamPos(previousStream[3*index], previousStream[3*index + 1]), position, alpha);
+        vColor = mix(unpackUnorm4x8(previousStream[3*index + 2]).rgb, vColor, alpha);
+    }
+#else
+    vec3 position = outputPos(index);
+    vec3 velocity = outputVel(index);
+    if (interpolation == 1) {
+        position = mix(inputPos(index), position, alpha);
+        velocity = mix(inputVel(index), velocity, alpha);
+    } else if (interpolation == 2) {
+        // the stored velocities are the tangents at both ends
+        vec3 previousVelocity = inputVel(index);
+        float t2 = alpha*alpha;
+        float t3 = t2*alpha;
+        position = (2*t3 - 3*t2 + 1)*inputPos(index) + (t3 - 2*t2 + alpha)*stepTime*previousVelocity
+                 + (3*t2 - 2*t3)*position + (t3 - t2)*stepTime*velocity;
+        velocity = mix(previousVelocity, velocity, alpha);
+    }
     // color computation
-    float colorRotation = max(0, min(PI, PI*(length(inBuffer.particles[index].vel.xyz)/maxVelocity)));
+    float colorRotation = max(0, min(PI, PI*(length(velocity)/maxVelocity)));
     vColor = vec3(max(0, -cos(colorRotation)), sin(colorRotation), max(0, cos(colorRotation)));
-}
\ No newline at end of file
+    float size = 0.1*pow(outputMass(index), 1./3.);
+#endif
+
+#if defined(BILLBOARD_QUADS)
+    // the diamond particle.geom emits, drawn as a strip of left, bottom, top and right
+    const vec2 corners[4] = vec2[](vec2(-1, 0), vec2(0, -1), vec2(0, 1), vec2(1, 0));
+    vCorner = corners[gl_VertexID];
+    gl_Position = viewMatrix*vec4(position + rotationMatrix*vec3(size*vCorner, 0), 1);
+#elif defined(BILLBOARD_POINTS)
+    // a screen aligned square as wide as the diamond's projection
+    vec4 center = viewMatrix*vec4(position, 1);
+    vec4 top = viewMatrix*vec4(position + rotationMatrix*vec3(0, size, 0), 1);
+    gl_PointSize = length((top.xy/top.w - center.xy/center.w)*viewport);
+    gl_Position = center;
+#elif defined(LOD_POINTS)
+    // the diamond's average color, and its area times its average opacity as the coverage
+    gl_Position = viewMatrix*vec4(position, 1);
+    float pixels = 2*size*pixelScale/gl_Position.w;
+    vColor = mix(vColor, vec3(1), 1./3.);
+    vCoverage = min(1, pixels*pixels/6);
+    gl_PointSize = 1;
+#else
+    gl_Position = vec4(position, 1);
+    vSize = size;
+#endif
+}
@@ -0,0 +1,28 @@
+#version 430 core
+layout(location = 0) out vec4 color;
+
+in vec3 vColor;
+#if defined(LOD_POINTS)
+in float vCoverage;
+#elif !defined(BILLBOARD_POINTS)
+in vec2 vCorner; // position in the diamond, its tips are 1 from the middle
+#endif
+
+void main(){
+#if defined(LOD_POINTS)
+    color = vec4(vColor, vCoverage);
+#else
+#if defined(BILLBOARD_POINTS)
+    vec2 corner = 2*gl_PointCoord - 1;
+#else
+    vec2 corner = vCorner;
+#endif
+    // the blend particle.geom's triangles interpolate, white in the middle and the body's color
+    // fading out towards the tips
+    float weight = 1 - abs(corner.x) - abs(corner.y);
+    if (weight < 0) {
+        discard;
+    }
+    color = mix(vec4(vColor, 0), vec4(1), weight);
+#endif
+}
@@ -0,0 +1,355 @@
+#include <barnesHutEngine.h>
+#include <algorithm>
+#include <math.h>
+#include <stdio.h>
+
+// deep enough for any float position, stops coincident bodies from recursing forever
+const int MAX_TREE_DEPTH = 32;
+
+// bodies per parallel task, small enough to balance and large enough to share tree paths
+const int WALK_CHUNK = 256;
+
+void Octree::build(const std::vector<Particle> &particles, int leafSize)
+{
+    this->leafSize = std::max(1, leafSize);
+    int count = particles.size();
+    nodes.clear();
+    order.resize(count);
+    scratch.resize(count);
+    x.resize(count);
+    y.resize(count);
+    z.resize(count);
+    mass.resize(count);
+    if (count == 0)
+    {
+        return;
+    }
+
+    float minimum[3] = {particles[0].pos.x, particles[0].pos.y, particles[0].pos.z};
+    float maximum[3] = {minimum[0], minimum[1], minimum[2]};
+    for (int i = 0; i < count; i++)
+    {
+        order[i] = i;
+        x[i] = particles[i].pos.x;
+        y[i] = particles[i].pos.y;
+        z[i] = particles[i].pos.z;
+        mass[i] = particles[i].mass();
+        for (int axis = 0; axis < 3; axis++)
+        {
+            minimum[axis] = std::min(minimum[axis], particles[i].pos[axis]);
+            maximum[axis] = std::max(maximum[axis], particles[i].pos[axis]);
+        }
+    }
+
+    rootSize = 0;
+    for (int axis = 0; axis < 3; axis++)
+    {
+        rootCenter[axis] = 0.5f * (minimum[axis] + maximum[axis]);
+        rootSize = std::max(rootSize, maximum[axis] - minimum[axis]);
+    }
+    // a little slack so bodies on the boundary fall inside
+    rootSize = rootSize * 1.001f + 1e-6f;
+
+    buildNode(0, count, rootCenter[0], rootCenter[1], rootCenter[2], 0.5f * rootSize, 0);
+
+    // gather the bodies into tree order so leaves read contiguous memory
+    std::vector<float> sorted(count);
+    std::vector<float> *fields[4] = {&x, &y, &z, &mass};
+    for (int f = 0; f < 4; f++)
+    {
+        for (int i = 0; i < count; i++)
+        {
+            sorted[i] = (*fields[f])[order[i]];
+        }
+        fields[f]->swap(sorted);
+    }
+
+    for (int n = nodes.size() - 1; n >= 0; n--)
+    {
+        computeMoments(n);
+    }
+}
+
+void Octree::buildNode(int begin, int end, float cx, float cy, float cz, float half, int depth)
+{
+    int index = nodes.size();
+    nodes.push_back(OctreeNode());
+    OctreeNode &node = nodes[index];
+    node.boxX = cx;
+    node.boxY = cy;
+    node.boxZ = cz;
+    node.size = 2 * half;
+    node.begin = begin;
+    node.end = end;
+    node.leaf = end - begin <= leafSize || depth >= MAX_TREE_DEPTH;
+
+    if (!node.leaf)
+    {
+        // counting sort of the range by octant
+        int counts[8] = {0};
+        for (int i = begin; i < end; i++)
+        {
+            int p = order[i];
+            int octant = (x[p] >= cx) | ((y[p] >= cy) << 1) | ((z[p] >= cz) << 2);
+            counts[octant]++;
+        }
+        int starts[9];
+        starts[0] = begin;
+        for (int o = 0; o < 8; o++)
+        {
+            starts[o + 1] = starts[o] + counts[o];
+        }
+        int offsets[8];
+        std::copy(starts, starts + 8, offsets);
+        for (int i = begin; i < end; i++)
+        {
+            int p = order[i];
+            int octant = (x[p] >= cx) | ((y[p] >= cy) << 1) | ((z[p] >= cz) << 2);
+            scratch[offsets[octant]++] = p;
+        }
+        std::copy(scratch.begin() + begin, scratch.begin() + end, order.begin() + begin);
+
+        float quarter = 0.5f * half;
+        for (int o = 0; o < 8; o++)
+        {
+            if (counts[o] > 0)
+            {
+                buildNode(starts[o], starts[o + 1],
+                          cx + ((o & 1) ? quarter : -quarter),
+                          cy + ((o & 2) ? quarter : -quarter),
+                          cz + ((o & 4) ? quarter : -quarter),
+                          quarter, depth + 1);
+            }
+        }
+    }
+    nodes[index].next = nodes.size();
+}
+
+// Adds m * (3 s s^T - |s|^2 I) for an offset s to a packed quadrupole
+static void addQuadrupole(float *quad, float m, float sx, float sy, float sz)
+{
+    float s2 = sx * sx + sy * sy + sz * sz;
+    quad[0] += m * (3 * sx * sx - s2);
+    quad[1] += m * (3 * sy * sy - s2);
+    quad[2] += m * (3 * sz * sz - s2);
+    quad[3] += m * 3 * sx * sy;
+    quad[4] += m * 3 * sx * sz;
+    quad[5] += m * 3 * sy * sz;
+}
+
+// Called children first, so inner nodes combine their children's moments
+void Octree::computeMoments(int index)
+{
+    OctreeNode &node = nodes[index];
+    double m = 0, mx = 0, my = 0, mz = 0;
+    if (node.leaf)
+    {
+        for (int i = node.begin; i < node.end; i++)
+        {
+            m += mass[i];
+            mx += mass[i] * x[i];
+            my += mass[i] * y[i];
+            mz += mass[i] * z[i];
+        }
+    }
+    else
+    {
+        for (int c = index + 1; c < node.next; c = nodes[c].next)
+        {
+            m += nodes[c].mass;
+            mx += nodes[c].mass * nodes[c].centerX;
+            my += nodes[c].mass * nodes[c].centerY;
+            mz += nodes[c].mass * nodes[c].centerZ;
+        }
+    }
+
+    node.mass = m;
+    if (m > 0)
+    {
+        node.centerX = mx / m;
+        node.centerY = my / m;
+        node.centerZ = mz / m;
+    }
+    else
+    {
+        node.centerX = node.boxX;
+        node.centerY = node.boxY;
+        node.centerZ = node.boxZ;
+    }
+
+    std::fill(node.quad, node.quad + 6, 0.0f);
+    if (node.leaf)
+    {
+        for (int i = node.begin; i < node.end; i++)
+        {
+            addQuadrupole(node.quad, mass[i], x[i] - node.centerX, y[i] - node.centerY, z[i] - node.centerZ);
+        }
+    }
+    else
+    {
+        // parallel axis theorem moves each child's quadrupole to our center of mass
+        for (int c = index + 1; c < node.next; c = nodes[c].next)
+        {
+            const OctreeNode &child = nodes[c];
+            for (int k = 0; k < 6; k++)
+            {
+                node.quad[k] += child.quad[k];
+            }
+            addQuadrupole(node.quad, child.mass, child.centerX - node.centerX, child.centerY - node.centerY, child.centerZ - node.centerZ);
+        }
+    }
+}
+
+BarnesHutEngine::BarnesHutEngine(const EngineConfig &config) : pool(config.threads, config.affinity)
+{
+    theta = config.theta;
+    leafSize = config.leafSize;
+    quadrupole = config.quadrupole;
+    threadInteractions.resize(pool.size());
+
+    char description[128];
+    snprintf(description, sizeof(description), "barneshut (theta %.2f, leaf %d, %s, %d threads)", theta, leafSize, quadrupole ? "quadrupole" : "monopole", pool.size());
+    engineName = description;
+}
+
+// Sums the pull of the tree on the body at tree position t
+cy::Vec3f BarnesHutEngine::walk(int t, long long &evaluated) const
+{
+    const OctreeNode *nodes = tree.nodes.data();
+    int nodeCount = tree.nodes.size();
+    const float *x = tree.x.data();
+    const float *y = tree.y.data();
+    const float *z = tree.z.data();
+    const float *mass = tree.mass.data();
+    float theta2 = theta * theta;
+
+    float xi = x[t];
+    float yi = y[t];
+    float zi = z[t];
+    float sumX = 0, sumY = 0, sumZ = 0;
+
+    int n = 0;
+    while (n < nodeCount)
+    {
+        const OctreeNode &node = nodes[n];
+        float half = 0.5f * node.size;
+        bool inside = fabsf(xi - node.boxX) <= half && fabsf(yi - node.boxY) <= half && fabsf(zi - node.boxZ) <= half;
+        float dx = node.centerX - xi;
+        float dy = node.centerY - yi;
+        float dz = node.centerZ - zi;
+        float dist2 = dx * dx + dy * dy + dz * dz;
+
+        if (!inside && node.size * node.size < theta2 * dist2)
+        {
+            // far enough away to treat as a single body at the center of mass
+            float invR = 1.0f / sqrtf(dist2);
+            float s = node.mass * invR / std::max(dist2, MIN_DISTANCE_SQUARED);
+            sumX += s * dx;
+            sumY += s * dy;
+            sumZ += s * dz;
+            if (quadrupole)
+            {
+                const float *q = node.quad;
+                float qx = q[0] * dx + q[3] * dy + q[4] * dz;
+                float qy = q[3] * dx + q[1] * dy + q[5] * dz;
+                float qz = q[4] * dx + q[5] * dy + q[2] * dz;
+                float invR2 = invR * invR;
+                float invR5 = invR2 * invR2 * invR;
+                float radial = 2.5f * (dx * qx + dy * qy + dz * qz) * invR5 * invR2;
+                sumX += radial * dx - qx * invR5;
+                sumY += radial * dy - qy * invR5;
+                sumZ += radial * dz - qz * invR5;
+            }
+            evaluated++;
+            n = node.next;
+        }
+        else if (node.leaf)
+        {
+            for (int j = node.begin; j < node.end; j++)
+            {
+                float ex = x[j] - xi;
+                float ey = y[j] - yi;
+                float ez = z[j] - zi;
+                float d2 = ex * ex + ey * ey + ez * ez;
+                if (d2 == 0)
+                {
+                    continue;
+                }
+                float s = mass[j] / (std::max(d2, MIN_DISTANCE_SQUARED) * sqrtf(d2));
+                sumX += s * ex;
+                sumY += s * ey;
+                sumZ += s * ez;
+            }
+            evaluated += node.end - node.begin;
+            n = node.next;
+        }
+        else
+        {
+            n++;
+        }
+    }
+
+    float gm = GRAVITY * mass[t];
+    return cy::Vec3f(gm * sumX, gm * sumY, gm * sumZ);
+}
+
+void BarnesHutEngine::computeAccelerations(const std::vector<Particle> &particles, std::vector<cy::Vec3f> &acc)
+{
+    tree.build(particles, leafSize);
+    std::fill(threadInteractions.begin(), threadInteractions.end(), 0);
+
+    // walk in tree order so neighbouring bodies in a chunk follow the same paths
+    int count = particles.size();
+    int chunkCount = (count + WALK_CHUNK - 1) / WALK_CHUNK;
+    pool.parallelFor(chunkCount, [&](int chunk, int thread) {
+        long long evaluated = 0;
+        int end = std::min(count, (chunk + 1) * WALK_CHUNK);
+        for (int t = chunk * WALK_CHUNK; t < end; t++)
+        {
+            acc[tree.order[t]] = walk(t, evaluated);
+        }
+        threadInteractions[thread] += evaluated;
+    });
+
+    for (size_t i = 0; i < threadInteractions.size(); i++)
+    {
+        interactions += threadInteractions[i];
+    }
+}
+
+void BarnesHutEngine::computeActiveAccelerations(const std::vector<Particle> &particles, const std::vector<int> &active, std::vector<cy::Vec3f> &acc)
+{
+    tree.build(particles, leafSize);
+    std::fill(threadInteractions.begin(), threadInteractions.end(), 0);
+
+    // still walk in tree order
+    treePositions.resize(particles.size());
+    for (size_t t = 0; t < tree.order.size(); t++)
+    {
+        treePositions[tree.order[t]] = t;
+    }
+    activePositions.resize(active.size());
+    for (size_t i = 0; i < active.size(); i++)
+    {
+        activePositions[i] = treePositions[active[i]];
+    }
+    std::sort(activePositions.begin(), activePositions.end());
+
+    int count = activePositions.size();
+    int chunkCount = (count + WALK_CHUNK - 1) / WALK_CHUNK;
+    pool.parallelFor(chunkCount, [&](int chunk, int thread) {
+        long long evaluated = 0;
+        int end = std::min(count, (chunk + 1) * WALK_CHUNK);
+        for (int i = chunk * WALK_CHUNK; i < end; i++)
+        {
+            int t = activePositions[i];
+            acc[tree.order[t]] = walk(t, evaluated);
+        }
+        threadInteractions[thread] += evaluated;
+    });
+
+    for (size_t i = 0; i < threadInteractions.size(); i++)
+    {
+        interactions += threadInteractions[i];
+    }
+}
@@ -0,0 +1,213 @@
+#include <checkpoint.h>
+#include <iostream>
+#include <stdio.h>
+#include <string.h>
+#ifdef _WIN32
+#include <io.h>
+#include <windows.h>
+#else
+#include <unistd.h>
+#endif
+
+static void writeValue(FILE *file, const void *data, size_t bytes, bool &ok)
+{
+    ok = ok && fwrite(data, 1, bytes, file) == bytes;
+}
+
+template <typename T>
+static void writeValues(FILE *file, const T *data, uint64_t count, bool &ok)
+{
+    writeValue(file, &count, sizeof(count), ok);
+    if (count > 0)
+    {
+        writeValue(file, data, sizeof(T) * count, ok);
+    }
+}
+
+static void readValue(FILE *file, void *data, size_t bytes, bool &ok)
+{
+    ok = ok && fread(data, 1, bytes, file) == bytes;
+}
+
+template <typename T>
+static void readValues(FILE *file, std::vector<T> &values, bool &ok)
+{
+    uint64_t count = 0;
+    readValue(file, &count, sizeof(count), ok);
+    // a damaged count must not turn into a huge allocation
+    long position = ftell(file);
+    fseek(file, 0, SEEK_END);
+    uint64_t remaining = ftell(file) - position;
+    fseek(file, position, SEEK_SET);
+    if (!ok || count > remaining / sizeof(T))
+    {
+        ok = false;
+        return;
+    }
+    values.resize(count);
+    if (count > 0)
+    {
+        readValue(file, values.data(), sizeof(T) * count, ok);
+    }
+}
+
+static void readString(FILE *file, std::string &text, bool &ok)
+{
+    std::vector<char> characters;
+    readValues(file, characters, ok);
+    text.assign(characters.begin(), characters.end());
+}
+
+bool writeCheckpoint(const std::string &path, const Checkpoint &checkpoint)
+{
+    std::string temporary = path + ".tmp";
+    FILE *file = fopen(temporary.c_str(), "wb");
+    if (file == nullptr)
+    {
+        std::cerr << "Could not open " << temporary << " for the checkpoint" << std::endl;
+        return false;
+    }
+
+    bool ok = true;
+    writeValue(file, CHECKPOINT_MAGIC, sizeof(CHECKPOINT_MAGIC), ok);
+    writeValue(file, &CHECKPOINT_VERSION, sizeof(CHECKPOINT_VERSION), ok);
+    writeValue(file, &checkpoint.step, sizeof(checkpoint.step), ok);
+    writeValue(file, &checkpoint.dt, sizeof(checkpoint.dt), ok);
+    writeValues(file, checkpoint.integrator.data(), checkpoint.integrator.size(), ok);
+    writeValues(file, checkpoint.integratorState.data(), checkpoint.integratorState.size(), ok);
+    writeValues(file, checkpoint.rngState.data(), checkpoint.rngState.size(), ok);
+    writeValues(file, checkpoint.initialParticles.data(), checkpoint.initialParticles.size(), ok);
+    writeValues(file, checkpoint.particles.data(), checkpoint.particles.size(), ok);
+    writeValues(file, checkpoint.bodyIds.data(), checkpoint.bodyIds.size(), ok);
+    // the rename must not reach the disk before the data it points to
+    ok = ok && fflush(file) == 0;
+#ifdef _WIN32
+    ok = ok && _commit(_fileno(file)) == 0;
+#else
+    ok = ok && fsync(fileno(file)) == 0;
+#endif
+    ok = fclose(file) == 0 && ok;
+    if (!ok)
+    {
+        std::cerr << "Could not write the checkpoint to " << temporary << std::endl;
+        remove(temporary.c_str());
+        return false;
+    }
+
+#ifdef _WIN32
+    ok = MoveFileExA(temporary.c_str(), path.c_str(), MOVEFILE_REPLACE_EXISTING | MOVEFILE_WRITE_THROUGH) != 0;
+#else
+    ok = rename(temporary.c_str(), path.c_str()) == 0;
+#endif
+    if (!ok)
+    {
+        std::cerr << "Could not move the checkpoint to " << path << std::endl;
+    }
+    return ok;
+}
+
+bool readCheckpoint(const std::string &path, Checkpoint &checkpoint)
+{
+    FILE *file = fopen(path.c_str(), "rb");
+    if (file == nullptr)
+    {
+        std::cerr << "Could not open checkpoint " << path << std::endl;
+        return false;
+    }
+
+    bool ok = true;
+    char magic[sizeof(CHECKPOINT_MAGIC)];
+    uint32_t version = 0;
+    readValue(file, magic, sizeof(magic), ok);
+    readValue(file, &version, sizeof(version), ok);
+    if (!ok || memcmp(magic, CHECKPOINT_MAGIC, sizeof(magic)) != 0 || version != CHECKPOINT_VERSION)
+    {
+        std::cerr << path << " is not a checkpoint this build can read" << std::endl;
+        fclose(file);
+        return false;
+    }
+    readValue(file, &checkpoint.step, sizeof(checkpoint.step), ok);
+    readValue(file, &checkpoint.dt, sizeof(checkpoint.dt), ok);
+    readString(file, checkpoint.integrator, ok);
+    readValues(file, checkpoint.integratorState, ok);
+    readString(file, checkpoint.rngState, ok);
+    readValues(file, checkpoint.initialParticles, ok);
+    readValues(file, checkpoint.particles, ok);
+    readValues(file, checkpoint.bodyIds, ok);
+    fclose(file);
+    if (!ok || checkpoint.bodyIds.size() != checkpoint.particles.size())
+    {
+        std::cerr << "Checkpoint " << path << " is incomplete" << std::endl;
+        return false;
+    }
+    return true;
+}
+
+CheckpointWriter::CheckpointWriter(const std::string &path) : written(0), dropped(0)
+{
+    this->path = path;
+    worker = std::thread(&CheckpointWriter::writerLoop, this);
+}
+
+CheckpointWriter::~CheckpointWriter()
+{
+    close();
+}
+
+void CheckpointWriter::close()
+{
+    if (!worker.joinable())
+    {
+        return;
+    }
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+    }
+    wake.notify_one();
+    worker.join();
+}
+
+bool CheckpointWriter::save(Checkpoint &checkpoint)
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (stopping)
+        {
+            return false;
+        }
+        if (busy)
+        {
+            dropped++;
+            return false;
+        }
+        std::swap(next, checkpoint);
+        busy = true;
+    }
+    wake.notify_one();
+    return true;
+}
+
+void CheckpointWriter::writerLoop()
+{
+    while (true)
+    {
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            wake.wait(lock, [this] { return stopping || busy; });
+            if (!busy)
+            {
+                return;
+            }
+        }
+
+        // save() leaves next alone while busy is set
+        if (writeCheckpoint(path, next))
+        {
+            written++;
+        }
+
+        std::lock_guard<std::mutex> lock(mutex);
+        busy = false;
+    }
+}
@@ -0,0 +1,109 @@
+#include <fft.h>
+#include <math.h>
+
+bool isPowerOfTwo(int n)
+{
+    return n > 0 && (n & (n - 1)) == 0;
+}
+
+void Fft3d::plan(int n)
+{
+    if (this->n == n)
+    {
+        return;
+    }
+    this->n = n;
+
+    twiddles.resize(n / 2);
+    for (int i = 0; i < n / 2; i++)
+    {
+        double angle = -2 * M_PI * i / n;
+        twiddles[i] = Complex(cos(angle), sin(angle));
+    }
+
+    int bits = 0;
+    while ((1 << bits) < n)
+    {
+        bits++;
+    }
+    reversed.resize(n);
+    for (int i = 0; i < n; i++)
+    {
+        int r = 0;
+        for (int b = 0; b < bits; b++)
+        {
+            r |= ((i >> b) & 1) << (bits - 1 - b);
+        }
+        reversed[i] = r;
+    }
+    scratch.clear();
+}
+
+void Fft3d::transformLine(Complex *line, bool inverse) const
+{
+    for (int i = 0; i < n; i++)
+    {
+        if (i < reversed[i])
+        {
+            std::swap(line[i], line[reversed[i]]);
+        }
+    }
+    for (int length = 2; length <= n; length <<= 1)
+    {
+        int half = length / 2;
+        int stride = n / length;
+        for (int start = 0; start < n; start += length)
+        {
+            for (int k = 0; k < half; k++)
+            {
+                Complex w = twiddles[k * stride];
+                if (inverse)
+                {
+                    w = std::conj(w);
+                }
+                Complex even = line[start + k];
+                Complex odd = w * line[start + k + half];
+                line[start + k] = even + odd;
+                line[start + k + half] = even - odd;
+            }
+        }
+    }
+}
+
+void Fft3d::transform(Complex *grid, bool inverse, ThreadPool &pool)
+{
+    if ((int)scratch.size() < pool.size())
+    {
+        scratch.assign(pool.size(), std::vector<Complex>(n));
+    }
+
+    // one pass per axis, lines that aren't contiguous go through a per-thread copy
+    long long strides[3] = {1, n, (long long)n * n};
+    for (int axis = 0; axis < 3; axis++)
+    {
+        long long stride = strides[axis];
+        long long outerStride = axis == 2 ? n : (long long)n * n;
+        long long innerStride = axis == 0 ? n : 1;
+        pool.parallelFor(n, [&](int outer, int thread) {
+            Complex *line = &scratch[thread][0];
+            for (int inner = 0; inner < n; inner++)
+            {
+                Complex *start = grid + outer * outerStride + inner * innerStride;
+                if (stride == 1)
+                {
+                    transformLine(start, inverse);
+                    continue;
+                }
+                for (int i = 0; i < n; i++)
+                {
+                    line[i] = start[i * stride];
+                }
+                transformLine(line, inverse);
+                for (int i = 0; i < n; i++)
+                {
+                    start[i * stride] = line[i];
+                }
+            }
+        });
+    }
+}
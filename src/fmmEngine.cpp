@@ -0,0 +1,386 @@
+#include <fmmEngine.h>
+#include <algorithm>
+#include <math.h>
+#include <stdio.h>
+
+// enough to keep double coefficients meaningful
+const int MAX_EXPANSION_ORDER = 12;
+const int MAX_EXPANSION_TERMS = (MAX_EXPANSION_ORDER + 1) * (MAX_EXPANSION_ORDER + 2) * (MAX_EXPANSION_ORDER + 3) / 6;
+
+static double binomial(int n, int k)
+{
+    double result = 1;
+    for (int i = 1; i <= k; i++)
+    {
+        result = result * (n - k + i) / i;
+    }
+    return result;
+}
+
+int ExpansionTables::index(int x, int y, int z) const
+{
+    if (x < 0 || y < 0 || z < 0 || x + y + z > order)
+    {
+        return -1;
+    }
+    // terms are ordered by degree, then by descending x, then descending y
+    int degree = x + y + z;
+    int before = degree * (degree + 1) * (degree + 2) / 6;
+    int rest = degree - x; // y + z
+    int offset = rest * (rest + 1) / 2 + (rest - y);
+    return before + offset;
+}
+
+void ExpansionTables::build(int order)
+{
+    this->order = order;
+    terms.clear();
+    for (int degree = 0; degree <= order; degree++)
+    {
+        for (int x = degree; x >= 0; x--)
+        {
+            for (int y = degree - x; y >= 0; y--)
+            {
+                Term term;
+                term.x = x;
+                term.y = y;
+                term.z = degree - x - y;
+                term.degree = degree;
+                terms.push_back(term);
+            }
+        }
+    }
+    for (size_t t = 0; t < terms.size(); t++)
+    {
+        Term &term = terms[t];
+        term.lower[0] = index(term.x - 1, term.y, term.z);
+        term.lower[1] = index(term.x, term.y - 1, term.z);
+        term.lower[2] = index(term.x, term.y, term.z - 1);
+        term.lower2[0] = index(term.x - 2, term.y, term.z);
+        term.lower2[1] = index(term.x, term.y - 2, term.z);
+        term.lower2[2] = index(term.x, term.y, term.z - 2);
+    }
+
+    multipoleShift.clear();
+    localShift.clear();
+    multipoleToLocal.clear();
+    for (size_t a = 0; a < terms.size(); a++)
+    {
+        for (size_t b = 0; b < terms.size(); b++)
+        {
+            const Term &k = terms[a];
+            const Term &l = terms[b];
+            double choose = 1;
+            // M2M: M'_k += C(k, l) d^(k - l) M_l for l <= k
+            if (l.x <= k.x && l.y <= k.y && l.z <= k.z)
+            {
+                choose = binomial(k.x, l.x) * binomial(k.y, l.y) * binomial(k.z, l.z);
+                Product shift = {(int)a, (int)b, index(k.x - l.x, k.y - l.y, k.z - l.z), choose};
+                multipoleShift.push_back(shift);
+            }
+            // L2L: L'_m += C(n, m) d^(n - m) L_n for n >= m
+            if (l.x >= k.x && l.y >= k.y && l.z >= k.z)
+            {
+                choose = binomial(l.x, k.x) * binomial(l.y, k.y) * binomial(l.z, k.z);
+                Product shift = {(int)a, (int)b, index(l.x - k.x, l.y - k.y, l.z - k.z), choose};
+                localShift.push_back(shift);
+            }
+            // M2L: L_n += (-1)^|k| C(k + n, n) a_(k + n) M_k, truncated at |k| + |n| <= order
+            if (k.degree + l.degree <= order)
+            {
+                choose = binomial(k.x + l.x, k.x) * binomial(k.y + l.y, k.y) * binomial(k.z + l.z, k.z);
+                double sign = (l.degree & 1) ? -1 : 1;
+                Product m2l = {(int)a, (int)b, index(k.x + l.x, k.y + l.y, k.z + l.z), sign * choose};
+                multipoleToLocal.push_back(m2l);
+            }
+        }
+    }
+}
+
+void ExpansionTables::monomials(double dx, double dy, double dz, double *out) const
+{
+    double d[3] = {dx, dy, dz};
+    out[0] = 1;
+    for (size_t t = 1; t < terms.size(); t++)
+    {
+        const Term &term = terms[t];
+        int axis = term.lower[0] >= 0 ? 0 : (term.lower[1] >= 0 ? 1 : 2);
+        out[t] = out[term.lower[axis]] * d[axis];
+    }
+}
+
+// Uses the recurrence |k| r^2 a_k = -(2|k| - 1) sum_i d_i a_(k - e_i) - (|k| - 1) sum_i a_(k - 2e_i)
+void ExpansionTables::derivatives(double dx, double dy, double dz, double *out) const
+{
+    double d[3] = {dx, dy, dz};
+    double r2 = dx * dx + dy * dy + dz * dz;
+    double invR2 = 1.0 / r2;
+    out[0] = sqrt(invR2);
+    for (size_t t = 1; t < terms.size(); t++)
+    {
+        const Term &term = terms[t];
+        double first = 0;
+        double second = 0;
+        for (int axis = 0; axis < 3; axis++)
+        {
+            if (term.lower[axis] >= 0)
+            {
+                first += d[axis] * out[term.lower[axis]];
+            }
+            if (term.lower2[axis] >= 0)
+            {
+                second += out[term.lower2[axis]];
+            }
+        }
+        out[t] = -((2 * term.degree - 1) * first + (term.degree - 1) * second) * invR2 / term.degree;
+    }
+}
+
+FmmEngine::FmmEngine(const EngineConfig &config) : pool(config.threads, config.affinity)
+{
+    theta = config.theta;
+    leafSize = config.leafSize;
+    tables.build(std::max(1, std::min(MAX_EXPANSION_ORDER, config.fmmOrder)));
+    threadInteractions.resize(pool.size());
+
+    char description[128];
+    snprintf(description, sizeof(description), "fmm (order %d, theta %.2f, leaf %d, %d threads)", tables.order, theta, leafSize, pool.size());
+    engineName = description;
+}
+
+// P2M at leaves, M2M everywhere else. Children have to be done first.
+void FmmEngine::upwardPass(int index)
+{
+    const OctreeNode &node = tree.nodes[index];
+    int termCount = tables.terms.size();
+    double *multipole = &multipoles[index * termCount];
+    std::fill(multipole, multipole + termCount, 0.0);
+    double powers[MAX_EXPANSION_TERMS];
+    float radius = 0;
+
+    if (node.leaf)
+    {
+        for (int i = node.begin; i < node.end; i++)
+        {
+            double sx = tree.x[i] - node.centerX;
+            double sy = tree.y[i] - node.centerY;
+            double sz = tree.z[i] - node.centerZ;
+            tables.monomials(sx, sy, sz, powers);
+            for (int t = 0; t < termCount; t++)
+            {
+                multipole[t] += tree.mass[i] * powers[t];
+            }
+            radius = std::max(radius, (float)sqrt(sx * sx + sy * sy + sz * sz));
+        }
+    }
+    else
+    {
+        for (int c = index + 1; c < node.next; c = tree.nodes[c].next)
+        {
+            const OctreeNode &child = tree.nodes[c];
+            double dx = child.centerX - node.centerX;
+            double dy = child.centerY - node.centerY;
+            double dz = child.centerZ - node.centerZ;
+            tables.monomials(dx, dy, dz, powers);
+            const double *childMultipole = &multipoles[c * termCount];
+            for (size_t p = 0; p < tables.multipoleShift.size(); p++)
+            {
+                const ExpansionTables::Product &shift = tables.multipoleShift[p];
+                multipole[shift.target] += shift.coefficient * powers[shift.monomial] * childMultipole[shift.source];
+            }
+            radius = std::max(radius, radii[c] + (float)sqrt(dx * dx + dy * dy + dz * dz));
+        }
+    }
+    radii[index] = radius;
+}
+
+// Dual tree traversal: M2L for well separated cells, P2P between touching leaves,
+// otherwise the bigger cell is split. Only target's subtree is written to.
+// Cells whose bodies can come inside the softening radius are never expanded, the
+// expansion is of the bare 1/r and only P2P clamps r2 like the reference.
+void FmmEngine::interact(int target, int source, long long &evaluated)
+{
+    const OctreeNode &a = tree.nodes[target];
+    const OctreeNode &b = tree.nodes[source];
+    if (b.mass == 0)
+    {
+        return;
+    }
+
+    double dx = a.centerX - b.centerX;
+    double dy = a.centerY - b.centerY;
+    double dz = a.centerZ - b.centerZ;
+    double dist2 = dx * dx + dy * dy + dz * dz;
+    double reach = radii[target] + radii[source];
+
+    if (reach * reach < theta * theta * dist2 && sqrt(dist2) - reach >= sqrt(MIN_DISTANCE_SQUARED))
+    {
+        int termCount = tables.terms.size();
+        double derivatives[MAX_EXPANSION_TERMS];
+        tables.derivatives(dx, dy, dz, derivatives);
+        double *local = &locals[target * termCount];
+        const double *multipole = &multipoles[source * termCount];
+        for (size_t p = 0; p < tables.multipoleToLocal.size(); p++)
+        {
+            const ExpansionTables::Product &m2l = tables.multipoleToLocal[p];
+            local[m2l.target] += m2l.coefficient * derivatives[m2l.monomial] * multipole[m2l.source];
+        }
+        evaluated++;
+    }
+    else if (a.leaf && b.leaf)
+    {
+        for (int i = a.begin; i < a.end; i++)
+        {
+            float sumX = 0, sumY = 0, sumZ = 0;
+            for (int j = b.begin; j < b.end; j++)
+            {
+                float ex = tree.x[j] - tree.x[i];
+                float ey = tree.y[j] - tree.y[i];
+                float ez = tree.z[j] - tree.z[i];
+                float d2 = ex * ex + ey * ey + ez * ez;
+                if (d2 == 0)
+                {
+                    continue;
+                }
+                float s = tree.mass[j] / (std::max(d2, MIN_DISTANCE_SQUARED) * sqrtf(d2));
+                sumX += s * ex;
+                sumY += s * ey;
+                sumZ += s * ez;
+            }
+            gx[i] += sumX;
+            gy[i] += sumY;
+            gz[i] += sumZ;
+        }
+        evaluated += (long long)(a.end - a.begin) * (b.end - b.begin);
+    }
+    else if (b.leaf || (!a.leaf && a.size >= b.size))
+    {
+        for (int c = target + 1; c < a.next; c = tree.nodes[c].next)
+        {
+            interact(c, source, evaluated);
+        }
+    }
+    else
+    {
+        for (int c = source + 1; c < b.next; c = tree.nodes[c].next)
+        {
+            interact(target, c, evaluated);
+        }
+    }
+}
+
+// L2L into the children, L2P at the leaves
+void FmmEngine::downwardPass(int index)
+{
+    const OctreeNode &node = tree.nodes[index];
+    int termCount = tables.terms.size();
+    const double *local = &locals[index * termCount];
+    double powers[MAX_EXPANSION_TERMS];
+
+    if (!node.leaf)
+    {
+        for (int c = index + 1; c < node.next; c = tree.nodes[c].next)
+        {
+            const OctreeNode &child = tree.nodes[c];
+            tables.monomials(child.centerX - node.centerX, child.centerY - node.centerY, child.centerZ - node.centerZ, powers);
+            double *childLocal = &locals[c * termCount];
+            for (size_t p = 0; p < tables.localShift.size(); p++)
+            {
+                const ExpansionTables::Product &shift = tables.localShift[p];
+                childLocal[shift.target] += shift.coefficient * powers[shift.monomial] * local[shift.source];
+            }
+        }
+        return;
+    }
+
+    // the field is the gradient of sum L_n t^n
+    for (int i = node.begin; i < node.end; i++)
+    {
+        tables.monomials(tree.x[i] - node.centerX, tree.y[i] - node.centerY, tree.z[i] - node.centerZ, powers);
+        double g[3] = {0, 0, 0};
+        for (int t = 1; t < termCount; t++)
+        {
+            const ExpansionTables::Term &term = tables.terms[t];
+            int exponent[3] = {term.x, term.y, term.z};
+            for (int axis = 0; axis < 3; axis++)
+            {
+                if (term.lower[axis] >= 0)
+                {
+                    g[axis] += exponent[axis] * local[t] * powers[term.lower[axis]];
+                }
+            }
+        }
+        gx[i] += g[0];
+        gy[i] += g[1];
+        gz[i] += g[2];
+    }
+}
+
+void FmmEngine::computeAccelerations(const std::vector<Particle> &particles, std::vector<cy::Vec3f> &acc)
+{
+    tree.build(particles, leafSize);
+    int count = particles.size();
+    int nodeCount = tree.nodes.size();
+    int termCount = tables.terms.size();
+    multipoles.resize((size_t)nodeCount * termCount);
+    locals.assign((size_t)nodeCount * termCount, 0.0);
+    radii.resize(nodeCount);
+    gx.assign(count, 0);
+    gy.assign(count, 0);
+    gz.assign(count, 0);
+    std::fill(threadInteractions.begin(), threadInteractions.end(), 0);
+    if (count == 0)
+    {
+        return;
+    }
+
+    // split the tree into independent subtrees, the nodes above them are done serially
+    int taskLimit = std::max(leafSize, count / (pool.size() * 16));
+    std::vector<int> tasks;
+    std::vector<int> ancestors;
+    for (int n = 0; n < nodeCount;)
+    {
+        const OctreeNode &node = tree.nodes[n];
+        if (node.leaf || node.end - node.begin <= taskLimit)
+        {
+            tasks.push_back(n);
+            n = node.next;
+        }
+        else
+        {
+            ancestors.push_back(n);
+            n++;
+        }
+    }
+
+    pool.parallelFor(tasks.size(), [&](int task, int /*thread*/) {
+        for (int n = tree.nodes[tasks[task]].next - 1; n >= tasks[task]; n--)
+        {
+            upwardPass(n);
+        }
+    });
+    for (int a = ancestors.size() - 1; a >= 0; a--)
+    {
+        upwardPass(ancestors[a]);
+    }
+
+    pool.parallelFor(tasks.size(), [&](int task, int thread) {
+        long long evaluated = 0;
+        interact(tasks[task], 0, evaluated);
+        for (int n = tasks[task]; n < tree.nodes[tasks[task]].next; n++)
+        {
+            downwardPass(n);
+        }
+        threadInteractions[thread] += evaluated;
+    });
+
+    for (int t = 0; t < count; t++)
+    {
+        float gm = GRAVITY * tree.mass[t];
+        acc[tree.order[t]] = cy::Vec3f(gm * gx[t], gm * gy[t], gm * gz[t]);
+    }
+    for (size_t i = 0; i < threadInteractions.size(); i++)
+    {
+        interactions += threadInteractions[i];
+    }
+}
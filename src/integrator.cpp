@@ -0,0 +1,341 @@
+#include <integrator.h>
+#include <algorithm>
+#include <math.h>
+#include <stdint.h>
+#include <string.h>
+
+static void kick(std::vector<Particle> &particles, const std::vector<cy::Vec3f> &acc, float dt)
+{
+    for (size_t i = 0; i < particles.size(); i++)
+    {
+        Particle &p = particles[i];
+        p.vel = cy::Vec4f(p.vel.x + acc[i].x * dt, p.vel.y + acc[i].y * dt, p.vel.z + acc[i].z * dt, 0);
+    }
+}
+
+static void drift(std::vector<Particle> &particles, float dt)
+{
+    for (size_t i = 0; i < particles.size(); i++)
+    {
+        Particle &p = particles[i];
+        p.pos = cy::Vec4f(p.pos.x + p.vel.x * dt, p.pos.y + p.vel.y * dt, p.pos.z + p.vel.z * dt, p.pos.w);
+    }
+}
+
+// values[slot] = old values[permutation[slot]]
+template <typename T>
+static void permuteValues(std::vector<T> &values, const std::vector<int> &permutation)
+{
+    if (values.size() != permutation.size())
+    {
+        return;
+    }
+    std::vector<T> old(values);
+    for (size_t slot = 0; slot < permutation.size(); slot++)
+    {
+        values[slot] = old[permutation[slot]];
+    }
+}
+
+// Appends a length prefixed copy of values
+template <typename T>
+static void saveValues(std::vector<char> &state, const std::vector<T> &values)
+{
+    uint64_t count = values.size();
+    const char *bytes = (const char *)&count;
+    state.insert(state.end(), bytes, bytes + sizeof(count));
+    bytes = (const char *)values.data();
+    state.insert(state.end(), bytes, bytes + sizeof(T) * count);
+}
+
+// Reads what saveValues wrote at offset and moves offset past it, false if state is too short
+template <typename T>
+static bool restoreValues(const std::vector<char> &state, size_t &offset, std::vector<T> &values)
+{
+    uint64_t count;
+    if (state.size() - offset < sizeof(count))
+    {
+        return false;
+    }
+    memcpy(&count, &state[offset], sizeof(count));
+    offset += sizeof(count);
+    if ((state.size() - offset) / sizeof(T) < count)
+    {
+        return false;
+    }
+    values.resize(count);
+    memcpy(values.data(), &state[offset], sizeof(T) * count);
+    offset += sizeof(T) * count;
+    return true;
+}
+
+void EulerIntegrator::step(NBodyEngine &engine, std::vector<Particle> &particles)
+{
+    acc.resize(particles.size());
+    engine.computeAccelerations(particles, acc);
+    bodyEvaluations += particles.size();
+    kick(particles, acc, dt);
+    drift(particles, dt);
+}
+
+void LeapfrogIntegrator::step(NBodyEngine &engine, std::vector<Particle> &particles)
+{
+    if (acc.size() != particles.size())
+    {
+        acc.resize(particles.size());
+        engine.computeAccelerations(particles, acc);
+        bodyEvaluations += particles.size();
+    }
+    kick(particles, acc, 0.5f * dt);
+    drift(particles, dt);
+    engine.computeAccelerations(particles, acc);
+    bodyEvaluations += particles.size();
+    kick(particles, acc, 0.5f * dt);
+}
+
+void LeapfrogIntegrator::permute(const std::vector<int> &permutation)
+{
+    permuteValues(acc, permutation);
+}
+
+void LeapfrogIntegrator::save(std::vector<char> &state) const
+{
+    saveValues(state, acc);
+}
+
+bool LeapfrogIntegrator::restore(const std::vector<char> &state)
+{
+    size_t offset = 0;
+    return restoreValues(state, offset, acc) && offset == state.size();
+}
+
+void YoshidaIntegrator::step(NBodyEngine &engine, std::vector<Particle> &particles)
+{
+    acc.resize(particles.size());
+    for (int stage = 0; stage < 3; stage++)
+    {
+        drift(particles, YOSHIDA_DRIFT[stage] * dt);
+        engine.computeAccelerations(particles, acc);
+        bodyEvaluations += particles.size();
+        kick(particles, acc, YOSHIDA_KICK[stage] * dt);
+    }
+    drift(particles, YOSHIDA_DRIFT[3] * dt);
+}
+
+void HermiteIntegrator::step(NBodyEngine &engine, std::vector<Particle> &particles)
+{
+    int count = particles.size();
+    if ((int)acc.size() != count)
+    {
+        acc.resize(count);
+        jerk.resize(count);
+        engine.computeAccelerationsAndJerks(particles, acc, jerk);
+        bodyEvaluations += count;
+    }
+    newAcc.resize(count);
+    newJerk.resize(count);
+
+    // predict with the Taylor series of the position and velocity
+    start = particles;
+    float dt2 = dt * dt / 2;
+    float dt3 = dt * dt * dt / 6;
+    for (int i = 0; i < count; i++)
+    {
+        Particle &p = particles[i];
+        cy::Vec3f pos = p.pos.XYZ() + p.vel.XYZ() * dt + acc[i] * dt2 + jerk[i] * dt3;
+        cy::Vec3f vel = p.vel.XYZ() + acc[i] * dt + jerk[i] * dt2;
+        p.pos = cy::Vec4f(pos, p.pos.w);
+        p.vel = cy::Vec4f(vel, 0);
+    }
+
+    engine.computeAccelerationsAndJerks(particles, newAcc, newJerk);
+    bodyEvaluations += count;
+
+    // correct with the Hermite interpolant through both ends
+    float dt12 = dt * dt / 12;
+    for (int i = 0; i < count; i++)
+    {
+        const Particle &old = start[i];
+        cy::Vec3f vel = old.vel.XYZ() + (acc[i] + newAcc[i]) * (dt / 2) + (jerk[i] - newJerk[i]) * dt12;
+        cy::Vec3f pos = old.pos.XYZ() + (old.vel.XYZ() + vel) * (dt / 2) + (acc[i] - newAcc[i]) * dt12;
+        particles[i].pos = cy::Vec4f(pos, old.pos.w);
+        particles[i].vel = cy::Vec4f(vel, 0);
+    }
+    acc.swap(newAcc);
+    jerk.swap(newJerk);
+}
+
+void HermiteIntegrator::permute(const std::vector<int> &permutation)
+{
+    permuteValues(acc, permutation);
+    permuteValues(jerk, permutation);
+}
+
+void HermiteIntegrator::save(std::vector<char> &state) const
+{
+    saveValues(state, acc);
+    saveValues(state, jerk);
+}
+
+bool HermiteIntegrator::restore(const std::vector<char> &state)
+{
+    size_t offset = 0;
+    return restoreValues(state, offset, acc) && restoreValues(state, offset, jerk) && offset == state.size();
+}
+
+Integrator *createIntegrator(const std::string &name, float dt)
+{
+    if (name == "euler")
+    {
+        return new EulerIntegrator(dt);
+    }
+    if (name == "leapfrog")
+    {
+        return new LeapfrogIntegrator(dt);
+    }
+    if (name == "yoshida")
+    {
+        return new YoshidaIntegrator(dt);
+    }
+    if (name == "hermite")
+    {
+        return new HermiteIntegrator(dt);
+    }
+    return nullptr;
+}
+
+double totalEnergy(const std::vector<Particle> &particles)
+{
+    double kinetic = 0;
+    double potential = 0;
+    double minDistance = sqrt(MIN_DISTANCE_SQUARED);
+    for (size_t i = 0; i < particles.size(); i++)
+    {
+        cy::Vec3f vel = particles[i].vel.XYZ();
+        kinetic += 0.5 * vel.Dot(vel);
+        for (size_t j = i + 1; j < particles.size(); j++)
+        {
+            cy::Vec3f delta = particles[j].pos.XYZ() - particles[i].pos.XYZ();
+            double dist = sqrt((double)delta.Dot(delta));
+            double gm = (double)GRAVITY * particles[i].mass() * particles[j].mass();
+            if (dist >= minDistance)
+            {
+                potential -= gm / dist;
+            }
+            else
+            {
+                potential += gm * ((dist - minDistance) / MIN_DISTANCE_SQUARED - 1 / minDistance);
+            }
+        }
+    }
+    return kinetic + potential;
+}
+
+BlockTimestepper::BlockTimestepper(int maxLevel, float eta, float dtMax)
+{
+    // levels are kept in an int bit shift
+    this->maxLevel = std::max(0, std::min(maxLevel, 20));
+    this->eta = eta;
+    this->dtMax = dtMax;
+}
+
+// Smallest level whose dt fits the body's criterion. Bodies may always move to a finer level,
+// but only one level coarser and only when the substep lines up with the coarser grid.
+int BlockTimestepper::chooseLevel(const cy::Vec3f &a, int body, int substep) const
+{
+    float accLength = a.Length();
+    float dt = dtMax;
+    if (accLength > 0)
+    {
+        dt = eta * sqrtf(sqrtf(MIN_DISTANCE_SQUARED) / accLength);
+        if (previousDt[body] > 0)
+        {
+            float jerk = (a - previousAcc[body]).Length() / previousDt[body];
+            if (jerk > 0)
+            {
+                dt = std::min(dt, eta * accLength / jerk);
+            }
+        }
+    }
+
+    int level = 0;
+    while (level < maxLevel && dtMax / (1 << level) > dt)
+    {
+        level++;
+    }
+
+    // the very first evaluation happens on substep 0, which lines up with every level
+    int current = levels[body];
+    if (previousDt[body] > 0 && level < current)
+    {
+        int coarser = current - 1;
+        int coarserSubsteps = 1 << (maxLevel - coarser);
+        level = substep % coarserSubsteps == 0 ? coarser : current;
+    }
+    return level;
+}
+
+void BlockTimestepper::step(NBodyEngine &engine, std::vector<Particle> &particles)
+{
+    int count = particles.size();
+    if ((int)levels.size() != count)
+    {
+        // everyone starts on the finest level and coarsens as the criterion allows
+        levels.assign(count, maxLevel);
+        previousAcc.assign(count, cy::Vec3f(0, 0, 0));
+        previousDt.assign(count, 0);
+    }
+    acc.resize(count);
+
+    int substeps = 1 << maxLevel;
+    float dtMin = dtMax / substeps;
+    for (int substep = 0; substep < substeps; substep++)
+    {
+        active.clear();
+        for (int i = 0; i < count; i++)
+        {
+            if (substep % (1 << (maxLevel - levels[i])) == 0)
+            {
+                active.push_back(i);
+            }
+        }
+        engine.computeActiveAccelerations(particles, active, acc);
+        bodyEvaluations += active.size();
+
+        // kick the active bodies over their new step
+        for (size_t a = 0; a < active.size(); a++)
+        {
+            int i = active[a];
+            levels[i] = chooseLevel(acc[i], i, substep);
+            float dt = dtMax / (1 << levels[i]);
+            previousAcc[i] = acc[i];
+            previousDt[i] = dt;
+
+            Particle &p = particles[i];
+            p.vel = cy::Vec4f(p.vel.x + acc[i].x * dt, p.vel.y + acc[i].y * dt, p.vel.z + acc[i].z * dt, 0);
+        }
+
+        drift(particles, dtMin);
+    }
+}
+
+void BlockTimestepper::permute(const std::vector<int> &permutation)
+{
+    permuteValues(levels, permutation);
+    permuteValues(previousAcc, permutation);
+    permuteValues(previousDt, permutation);
+}
+
+void BlockTimestepper::save(std::vector<char> &state) const
+{
+    saveValues(state, levels);
+    saveValues(state, previousAcc);
+    saveValues(state, previousDt);
+}
+
+bool BlockTimestepper::restore(const std::vector<char> &state)
+{
+    size_t offset = 0;
+    return restoreValues(state, offset, levels) && restoreValues(state, offset, previousAcc) &&
+           restoreValues(state, offset, previousDt) && offset == state.size();
+}
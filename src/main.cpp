@@ -13,15 +13,16 @@
 #include <vector>
 #include <map>
 #include <math.h>
-
-struct Particle
-{
-public:
-    cy::Vec4f pos;
-    cy::Vec4f vel;
-    double mass;
-    double padding;
-};
+#include <chrono>
+#include <nbody.h>
+#include <reorder.h>
+#include <integrator.h>
+#include <particleLayout.h>
+#include <particleRing.h>
+#include <snapshotReader.h>
+#include <trajectory.h>
+#include <checkpoint.h>
+#include <random>
 
 // window variables
 GLFWwindow *WINDOW;
@@ -36,10 +37,50 @@ float MINIMUM_MASS = 1.0;
 float MAXIMUM_MASS = 50.0;
 float VELOCITY_CUTOFF = 0.3; // fastest color beyond this point
 std::vector<Particle> particles;
-std::vector<int> particleIndices;
-GLuint particleInputBuffer;
-GLuint particleOutputBuffer;
-GLuint particleIndexBuffer;
+GLuint bodySlotBuffer = 0;     // slot of each body once the bodies were moved, until then vertex n draws slot n
+ParticleLayout particleLayout;
+ParticleRing particleRing;    // generations of the particle buffers, the current one is drawn
+GLuint integratorStateBuffer; // forces the gpu integrators carry between stages and steps
+bool gpuForcesValid = false;  // integratorStateBuffer matches the current generation
+
+// simulation variables
+bool HEADLESS = false;
+int STEP_COUNT = 1000;
+bool VALIDATE = false;
+EngineConfig engineConfig;
+NBodyEngine *engine = nullptr;
+std::vector<Particle> simulatedParticles; // host copy advanced by cpu engines
+std::string REORDER_CURVE = "none";
+int REORDER_INTERVAL = 16;
+SpatialReorder *reorder = nullptr;
+std::vector<int> bodyIds; // original index of the body in each slot of simulatedParticles
+int stepCount = 0;
+std::string INTEGRATOR = "euler";
+int TIMESTEP_LEVELS = 0; // block time step levels below DT, 0 keeps the shader's single step
+float TIMESTEP_ETA = 0.2;
+float DT = 1.0;
+Integrator *integrator = nullptr; // steps the cpu engines
+int SNAPSHOT_INTERVAL = 0;        // steps between snapshots read back to the host, 0 turns them off
+SnapshotReader *snapshotReader = nullptr;
+long long frameCount = 0;
+int SUBSTEPS = 1;               // simulation steps per displayed frame
+bool MAX_THROUGHPUT = false;    // no vsync and no sleep between frames
+int FRAME_LIMIT = 0;            // frames before the window closes itself, 0 runs until it is closed
+std::string RENDERER = "geometry"; // how bodies become billboards: geometry shader, instanced quads or point sprites
+float SIM_RATE = 0;             // simulation steps per second of wall time, 0 runs SUBSTEPS every frame
+std::string INTERPOLATION = "none"; // how drawn bodies move between the last two steps: none, linear or hermite
+float stepPhase = 1;            // fraction of the next step the wall clock has covered, drawn as alpha
+bool previousValid = false;     // the generation before the current one holds the step before it
+std::string RECORD_PATH;        // trajectory file the snapshots are appended to
+TrajectoryConfig trajectoryConfig;
+std::string LOAD_PATH;          // trajectory file the initial conditions come from
+long long LOAD_FRAME = -1;      // frame of LOAD_PATH to start from, negative counts back from the last one
+TrajectoryWriter *trajectoryWriter = nullptr;
+std::mt19937 rng;               // draws the initial conditions, saved in checkpoints
+std::string CHECKPOINT_PATH;    // file periodic checkpoints replace
+int CHECKPOINT_INTERVAL = 0;    // steps between checkpoints
+std::string RESTART_PATH;       // checkpoint the run continues from
+CheckpointWriter *checkpointWriter = nullptr;
 
 // camera movement variables
 float sensitivity = 0.005;
@@ -58,10 +99,24 @@ cy::Matrix4f viewMatrix;
 cy::Matrix4f viewMatrixInverse;
 
 // particle shader variables
+// uniforms of particle.vert, each variant of it is a program of its own
+struct ParticleUniforms
+{
+    GLuint viewMatrix;
+    GLuint rotationMatrix;
+    GLuint maxVelocity;
+    GLuint interpolation;
+    GLuint alpha;
+    GLuint stepTime;
+    GLuint permuted;
+    GLuint viewport;
+    GLuint pixelScale;
+    GLuint maxSize;
+};
 GLuint particleProgramID;
-GLuint particleMatrixID;
-GLuint particleRotationID;
-GLuint velocityCutoffID;
+ParticleUniforms particleUniforms;
+GLuint lodPointProgramID; // draws the bodies cull.comp found too small for a billboard
+ParticleUniforms lodPointUniforms;
 
 // cubemap shader variables
 GLuint quadProgramID;
@@ -71,18 +126,85 @@ GLuint EnvTextureID;
 GLuint EnvMatrixID;
 
 // gravity shader variables
+int WORKGROUP_SIZE = 128; // invocations sharing each tile of bodies in particle.comp
 GLuint gravityProgramID;
+GLuint gravityStageID;
+GLuint gravityCountID;
+GLuint gravityTimestepID;
+GLuint gravityCoefficientID;
+GLuint gravityMaxVelocityID;
+GLuint gravityMaxSizeID;
+bool RENDER_STREAM = false; // the gravity pass packs 12 bytes per body that the renderer reads instead
+float renderMaxSize = 0;    // size of the heaviest body, the top of the render stream's size byte
+
+// culling shader variables
+bool CULL = false;              // cull.comp drops the bodies off screen and draws the tiny ones as pixels
+float LOD_POINT_PIXELS = 2;     // bodies narrower on screen than this are drawn as single pixels
+float LOD_MERGE_PIXELS = 0.5;   // and narrower than this share their pixel, the lowest slot draws it
+const int CULL_GROUP_SIZE = 256;
+GLuint cullProgramID;
+GLuint cullStageID;
+GLuint cullCountID;
+GLuint cullPermutedID;
+GLuint cullMatrixID;
+GLuint cullFrustumID;
+GLuint cullViewportID;
+GLuint cullPixelScaleID;
+GLuint cullMotionScaleID;
+GLuint cullPointPixelsID;
+GLuint cullMergePixelsID;
+GLuint cullInstancedID;
+GLuint visibleBuffer;     // slots to draw, the billboards and then the points
+GLuint groupCountBuffer;  // two counts and later two offsets per group of cull.comp
+GLuint drawCommandBuffer; // indirect draws of the billboards and of the points
+GLuint pixelClaimBuffer = 0; // a uint per pixel for the merged bodies
+int claimWidth = 0;
+int claimHeight = 0;
+
+// stages of cull.comp, run in this order every frame
+enum CullStage
+{
+    STAGE_CLAIM,
+    STAGE_COUNT,
+    STAGE_SCAN,
+    STAGE_SCATTER
+};
+
+// stages of particle.comp, the integrators other than euler chain several per step
+enum GravityStage
+{
+    STAGE_EULER,
+    STAGE_ACCELERATION,
+    STAGE_KICK,
+    STAGE_DRIFT,
+    STAGE_ACCELERATION_JERK,
+    STAGE_PREDICT,
+    STAGE_CORRECT,
+    STAGE_PACK
+};
 
 void updateViewMatrix();
+void packRenderStream(int generation);
 
 // helper random number generator
 float randFloat(float min, float max)
 {
-    float r = ((float)rand()) / (float)RAND_MAX;
+    float r = (float)rng() / (float)rng.max();
     float diff = max - min;
     return min + r * diff;
 }
 
+// Body ids of slots that still hold the bodies in their original order
+std::vector<int> identityIds(size_t count)
+{
+    std::vector<int> ids(count);
+    for (size_t i = 0; i < count; i++)
+    {
+        ids[i] = i;
+    }
+    return ids;
+}
+
 // Prints any errors that may occur with OpenGL
 void glfwErrorCallback(int error, const char *description)
 {
@@ -105,17 +227,26 @@ void glfwKeyCallback(GLFWwindow *p_window, int p_key, int p_scancode, int p_acti
     }
     else if (p_key == GLFW_KEY_R && p_action == GLFW_RELEASE)
     {
-        glBindBuffer(GL_ARRAY_BUFFER, particleIndexBuffer);
-        glBufferData(GL_ARRAY_BUFFER, sizeof(int) * particleIndices.size(), &particleIndices[0], GL_STATIC_DRAW);
-        glBindBuffer(GL_ARRAY_BUFFER, 0);
+        simulatedParticles = particles;
+        bodyIds = identityIds(particles.size());
+        stepCount = 0;
+        integrator->reset();
+        gpuForcesValid = false;
+        previousValid = false;
+        // snapshots and checkpoints still on their way belong to the run that was just thrown away
+        if (snapshotReader != nullptr)
+        {
+            snapshotReader->discard();
+        }
 
-        glBindBuffer(GL_SHADER_STORAGE_BUFFER, particleInputBuffer);
-        glBufferData(GL_SHADER_STORAGE_BUFFER, sizeof(Particle) * particles.size(), &particles[0], GL_DYNAMIC_COPY);
-        glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+        glDeleteBuffers(1, &bodySlotBuffer);
+        bodySlotBuffer = 0;
 
-        glBindBuffer(GL_SHADER_STORAGE_BUFFER, particleOutputBuffer);
-        glBufferData(GL_SHADER_STORAGE_BUFFER, sizeof(Particle) * particles.size(), &particles[0], GL_DYNAMIC_DRAW);
-        glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+        particleRing.write(particleRing.current(), particles);
+        if (RENDER_STREAM)
+        {
+            packRenderStream(particleRing.current());
+        }
     }
 }
 
@@ -149,33 +280,39 @@ void glfwMouseMoveCallback(GLFWwindow *window, double xpos, double ypos)
     }
 }
 
+// Reads a shader file, declaring the particle buffers for the selected layout.
+// defines go right after the #version line.
+std::string readShaderSource(const char *path, const std::string &defines = "")
+{
+    std::ifstream shaderStream(path, std::ios::in);
+    std::stringstream sstr;
+    sstr << shaderStream.rdbuf();
+    shaderStream.close();
+
+    std::string code = sstr.str();
+    size_t versionEnd = code.find('\n');
+    if (!defines.empty() && versionEnd != std::string::npos)
+    {
+        code.insert(versionEnd + 1, defines);
+    }
+    return particleLayout.inject(code);
+}
+
 // Loads and reloads shaders
-void loadShaders(const char *vertexShader, const char *fragmentShader, const char *geometryShader, GLuint &programID, std::map<const char *, GLuint *> shaderArgs)
+void loadShaders(const char *vertexShader, const char *fragmentShader, const char *geometryShader, GLuint &programID, std::map<const char *, GLuint *> shaderArgs, const std::string &defines = "")
 {
     GLuint vertShaderID = glCreateShader(GL_VERTEX_SHADER);
-    std::ifstream vertShaderStream(vertexShader, std::ios::in);
-    std::stringstream vsstr;
-    vsstr << vertShaderStream.rdbuf();
-    std::string vertShaderCode = vsstr.str();
-    vertShaderStream.close();
+    std::string vertShaderCode = readShaderSource(vertexShader, defines);
 
     GLuint fragShaderID = glCreateShader(GL_FRAGMENT_SHADER);
-    std::ifstream fragShaderStream(fragmentShader, std::ios::in);
-    std::stringstream fsstr;
-    fsstr << fragShaderStream.rdbuf();
-    std::string fragShaderCode = fsstr.str();
-    fragShaderStream.close();
+    std::string fragShaderCode = readShaderSource(fragmentShader, defines);
 
     GLuint geomShaderID;
     std::string geomShaderCode;
     if (geometryShader != nullptr)
     {
         geomShaderID = glCreateShader(GL_GEOMETRY_SHADER);
-        std::ifstream geomShaderStream(geometryShader, std::ios::in);
-        std::stringstream gsstr;
-        gsstr << geomShaderStream.rdbuf();
-        geomShaderCode = gsstr.str();
-        geomShaderStream.close();
+        geomShaderCode = readShaderSource(geometryShader);
     }
 
     GLint result = GL_FALSE;
@@ -269,14 +406,10 @@ void loadShaders(const char *vertexShader, const char *fragmentShader, GLuint &p
     loadShaders(vertexShader, fragmentShader, nullptr, programID, shaderArgs);
 }
 
-void loadComputeShader(const char *computeShader, GLuint &programID, std::map<const char *, GLuint *> shaderArgs)
+void loadComputeShader(const char *computeShader, const std::string &defines, GLuint &programID, std::map<const char *, GLuint *> shaderArgs)
 {
     GLuint compShaderID = glCreateShader(GL_COMPUTE_SHADER);
-    std::ifstream compShaderStream(computeShader, std::ios::in);
-    std::stringstream csstr;
-    csstr << compShaderStream.rdbuf();
-    std::string compShaderCode = csstr.str();
-    compShaderStream.close();
+    std::string compShaderCode = readShaderSource(computeShader, defines);
 
     GLint result = GL_FALSE;
     int infoLogLength;
@@ -430,6 +563,11 @@ void initWindow()
     glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 5);
     glfwWindowHint(GLFW_OPENGL_FORWARD_COMPAT, GL_TRUE);
     glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
+    if (VALIDATE && engine == nullptr)
+    {
+        // only the compute shader runs, which works on software renderers like llvmpipe
+        glfwWindowHint(GLFW_VISIBLE, GLFW_FALSE);
+    }
     WINDOW = glfwCreateWindow(WIDTH, HEIGHT, "3D N-Body", NULL, NULL);
     if (!WINDOW)
     {
@@ -446,7 +584,7 @@ void initWindow()
     glfwMakeContextCurrent(WINDOW);
 
     // turn on VSYNC
-    glfwSwapInterval(1);
+    glfwSwapInterval(MAX_THROUGHPUT ? 0 : 1);
 
     glewExperimental = GL_TRUE;
     GLenum err = glewInit();
@@ -477,32 +615,167 @@ cy::Vec3f randomPrismPosition(float length, float width, float height)
     return cy::Vec3f(x, y, z);
 }
 
-void initParticles()
+// Takes the initial conditions from a frame of a recorded trajectory, exits if it can't be read
+void loadParticles()
+{
+    int64_t step;
+    if (!readTrajectoryFrame(LOAD_PATH, LOAD_FRAME, particles, step))
+    {
+        exit(1);
+    }
+    PARTICLE_COUNT = particles.size();
+    // recording continues the step numbers of the loaded run
+    stepCount = step;
+    std::cout << "loaded step " << step << " of " << LOAD_PATH << ", " << PARTICLE_COUNT << " particles" << std::endl;
+}
+
+// Picks up a run from a checkpoint, exits if it can't be resumed exactly
+void restoreCheckpoint()
+{
+    Checkpoint checkpoint;
+    if (!readCheckpoint(RESTART_PATH, checkpoint))
+    {
+        exit(1);
+    }
+    if (checkpoint.integrator != integrator->name() || !integrator->restore(checkpoint.integratorState))
+    {
+        std::cerr << RESTART_PATH << " was written by the " << checkpoint.integrator << " integrator, restart with --integrator="
+                  << checkpoint.integrator << std::endl;
+        exit(1);
+    }
+    if (checkpoint.dt != DT)
+    {
+        std::cerr << RESTART_PATH << " was written with --dt=" << checkpoint.dt << ", the run continues with " << DT << std::endl;
+    }
+    std::istringstream rngState(checkpoint.rngState);
+    rngState >> rng;
+
+    particles.swap(checkpoint.initialParticles);
+    simulatedParticles.swap(checkpoint.particles);
+    bodyIds.swap(checkpoint.bodyIds);
+    PARTICLE_COUNT = particles.size();
+    stepCount = checkpoint.step;
+    std::cout << "restarting at step " << stepCount << " from " << RESTART_PATH << ", " << PARTICLE_COUNT << " particles" << std::endl;
+}
+
+// Copies the host state into a checkpoint for the background writer
+// Captures everything but the particles, on the thread that owns the integrator and the generator
+void captureCheckpoint(Checkpoint &checkpoint, int step)
+{
+    checkpoint.step = step;
+    checkpoint.dt = DT;
+    checkpoint.integrator = integrator->name();
+    integrator->save(checkpoint.integratorState);
+    std::ostringstream rngState;
+    rngState << rng;
+    checkpoint.rngState = rngState.str();
+    checkpoint.initialParticles = particles;
+}
+
+// Adds the particles to a captured checkpoint and hands it to the background writer
+void saveCheckpoint(Checkpoint &checkpoint, const std::vector<Particle> &state, const std::vector<int> &slots)
+{
+    checkpoint.particles = state;
+    checkpoint.bodyIds = slots;
+    if (checkpoint.bodyIds.empty())
+    {
+        checkpoint.bodyIds = identityIds(state.size());
+    }
+    checkpointWriter->save(checkpoint);
+}
+
+// Builds the initial conditions on the host only, the headless mode stops here
+void generateParticles()
 {
+    if (!RESTART_PATH.empty())
+    {
+        restoreCheckpoint();
+        return;
+    }
+    if (!LOAD_PATH.empty())
+    {
+        loadParticles();
+        simulatedParticles = particles;
+        bodyIds = identityIds(particles.size());
+        return;
+    }
     for (int i = 0; i < PARTICLE_COUNT; i++)
     {
         Particle p;
         p.pos = cy::Vec4f(randomDiskPosition(10, 1), 0);
         p.vel = cy::Vec4f(randomPrismPosition(0.5, 0.5, 0.5), 0);
-        p.mass = randFloat(MINIMUM_MASS, MAXIMUM_MASS);
+        p.pos.w = randFloat(MINIMUM_MASS, MAXIMUM_MASS);
         particles.push_back(p);
-        particleIndices.push_back(i);
     }
+    simulatedParticles = particles;
+    bodyIds = identityIds(particles.size());
+}
 
-    glGenBuffers(1, &particleIndexBuffer);
-    glBindBuffer(GL_ARRAY_BUFFER, particleIndexBuffer);
-    glBufferData(GL_ARRAY_BUFFER, sizeof(int) * particleIndices.size(), &particleIndices[0], GL_STATIC_DRAW);
-    glBindBuffer(GL_ARRAY_BUFFER, 0);
-
-    glGenBuffers(1, &particleInputBuffer);
-    glBindBuffer(GL_SHADER_STORAGE_BUFFER, particleInputBuffer);
-    glBufferData(GL_SHADER_STORAGE_BUFFER, sizeof(Particle) * particles.size(), &particles[0], GL_DYNAMIC_COPY);
+// Hands the renderer the slot each body is stored in, so vertex n keeps drawing body n wherever
+// it is. Runs whose bodies never move don't need the buffer.
+void uploadBodySlots()
+{
+    std::vector<int> slots(bodyIds.size());
+    for (size_t slot = 0; slot < bodyIds.size(); slot++)
+    {
+        slots[bodyIds[slot]] = slot;
+    }
+    if (bodySlotBuffer == 0)
+    {
+        glGenBuffers(1, &bodySlotBuffer);
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, bodySlotBuffer);
+        glBufferData(GL_SHADER_STORAGE_BUFFER, sizeof(int) * slots.size(), &slots[0], GL_DYNAMIC_DRAW);
+    }
+    else
+    {
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, bodySlotBuffer);
+        glBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, sizeof(int) * slots.size(), &slots[0]);
+    }
     glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+}
+
+void initParticles()
+{
+    generateParticles();
+
+    // a restarted run can start with its bodies already sorted
+    if (bodyIds != identityIds(bodyIds.size()))
+    {
+        uploadBodySlots();
+    }
 
-    glGenBuffers(1, &particleOutputBuffer);
-    glBindBuffer(GL_SHADER_STORAGE_BUFFER, particleOutputBuffer);
-    glBufferData(GL_SHADER_STORAGE_BUFFER, sizeof(Particle) * particles.size(), &particles[0], GL_DYNAMIC_DRAW);
+    particleRing.init(&particleLayout, simulatedParticles);
+    if (RENDER_STREAM)
+    {
+        // masses never change, so the size byte can cover the range of this run
+        for (size_t i = 0; i < particles.size(); i++)
+        {
+            renderMaxSize = std::max(renderMaxSize, 0.1f * cbrtf(particles[i].mass()));
+        }
+        particleRing.initRenderStreams();
+        packRenderStream(particleRing.current());
+    }
+
+    // six vec4s per body, see IntegratorState in particle.comp
+    glGenBuffers(1, &integratorStateBuffer);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, integratorStateBuffer);
+    glBufferData(GL_SHADER_STORAGE_BUFFER, sizeof(cy::Vec4f) * 6 * particles.size(), nullptr, GL_DYNAMIC_COPY);
     glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+
+    if (CULL)
+    {
+        int groups = (particles.size() + CULL_GROUP_SIZE - 1) / CULL_GROUP_SIZE;
+        glGenBuffers(1, &visibleBuffer);
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, visibleBuffer);
+        glBufferData(GL_SHADER_STORAGE_BUFFER, sizeof(GLuint) * particles.size(), nullptr, GL_DYNAMIC_COPY);
+        glGenBuffers(1, &groupCountBuffer);
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, groupCountBuffer);
+        glBufferData(GL_SHADER_STORAGE_BUFFER, sizeof(GLuint) * 2 * groups, nullptr, GL_DYNAMIC_COPY);
+        glGenBuffers(1, &drawCommandBuffer);
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, drawCommandBuffer);
+        glBufferData(GL_SHADER_STORAGE_BUFFER, sizeof(GLuint) * 8, nullptr, GL_DYNAMIC_COPY);
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+    }
 }
 
 void initEnv()
@@ -521,13 +794,67 @@ void initEnv()
     glBufferData(GL_ARRAY_BUFFER, sizeof(cy::Vec3f) * verts.size(), &verts[0], GL_STATIC_DRAW);
 }
 
+std::map<const char *, GLuint *> particleShaderArgs(ParticleUniforms &uniforms)
+{
+    std::map<const char *, GLuint *> shaderArgs;
+    shaderArgs["viewMatrix"] = &uniforms.viewMatrix;
+    shaderArgs["rotationMatrix"] = &uniforms.rotationMatrix;
+    shaderArgs["maxVelocity"] = &uniforms.maxVelocity;
+    shaderArgs["interpolation"] = &uniforms.interpolation;
+    shaderArgs["alpha"] = &uniforms.alpha;
+    shaderArgs["stepTime"] = &uniforms.stepTime;
+    shaderArgs["permuted"] = &uniforms.permuted;
+    shaderArgs["viewport"] = &uniforms.viewport;
+    shaderArgs["pixelScale"] = &uniforms.pixelScale;
+    shaderArgs["maxSize"] = &uniforms.maxSize;
+    return shaderArgs;
+}
+
 void loadParticleShader()
+{
+    // culled bodies are drawn from the slots cull.comp leaves in visibleBuffer, and with a render
+    // stream from the packed copy instead of the particles
+    std::string defines = CULL ? "#define CULLED\n" : "";
+    if (RENDER_STREAM)
+    {
+        defines += "#define PACKED_STREAM\n";
+    }
+    std::map<const char *, GLuint *> shaderArgs = particleShaderArgs(particleUniforms);
+    if (RENDERER == "quads")
+    {
+        loadShaders("shaders\\particle.vert", "shaders\\particleSprite.frag", nullptr, particleProgramID, shaderArgs, "#define BILLBOARD_QUADS\n" + defines);
+    }
+    else if (RENDERER == "points")
+    {
+        loadShaders("shaders\\particle.vert", "shaders\\particleSprite.frag", nullptr, particleProgramID, shaderArgs, "#define BILLBOARD_POINTS\n" + defines);
+    }
+    else
+    {
+        loadShaders("shaders\\particle.vert", "shaders\\particle.frag", "shaders\\particle.geom", particleProgramID, shaderArgs, defines);
+    }
+    if (CULL)
+    {
+        loadShaders("shaders\\particle.vert", "shaders\\particleSprite.frag", nullptr, lodPointProgramID, particleShaderArgs(lodPointUniforms),
+                    "#define LOD_POINTS\n" + defines);
+    }
+}
+
+void loadCullShader()
 {
     std::map<const char *, GLuint *> shaderArgs;
-    shaderArgs["viewMatrix"] = &particleMatrixID;
-    shaderArgs["rotationMatrix"] = &particleRotationID;
-    shaderArgs["maxVelocity"] = &velocityCutoffID;
-    loadShaders("shaders\\particle.vert", "shaders\\particle.frag", "shaders\\particle.geom", particleProgramID, shaderArgs);
+    shaderArgs["stage"] = &cullStageID;
+    shaderArgs["particleCount"] = &cullCountID;
+    shaderArgs["permuted"] = &cullPermutedID;
+    shaderArgs["viewMatrix"] = &cullMatrixID;
+    shaderArgs["frustum"] = &cullFrustumID;
+    shaderArgs["viewport"] = &cullViewportID;
+    shaderArgs["pixelScale"] = &cullPixelScaleID;
+    shaderArgs["motionScale"] = &cullMotionScaleID;
+    shaderArgs["pointPixels"] = &cullPointPixelsID;
+    shaderArgs["mergePixels"] = &cullMergePixelsID;
+    shaderArgs["instanced"] = &cullInstancedID;
+    std::string defines = "#define CULL_GROUP_SIZE " + std::to_string(CULL_GROUP_SIZE) + "\n";
+    loadComputeShader("shaders\\cull.comp", defines, cullProgramID, shaderArgs);
 }
 
 void loadEnvShader()
@@ -541,7 +868,14 @@ void loadEnvShader()
 void loadGravityShader()
 {
     std::map<const char *, GLuint *> shaderArgs;
-    loadComputeShader("shaders\\particle.comp", gravityProgramID, shaderArgs);
+    shaderArgs["stage"] = &gravityStageID;
+    shaderArgs["particleCount"] = &gravityCountID;
+    shaderArgs["dt"] = &gravityTimestepID;
+    shaderArgs["coefficient"] = &gravityCoefficientID;
+    shaderArgs["maxVelocity"] = &gravityMaxVelocityID;
+    shaderArgs["maxSize"] = &gravityMaxSizeID;
+    std::string defines = "#define WORKGROUP_SIZE " + std::to_string(WORKGROUP_SIZE) + "\n";
+    loadComputeShader("shaders\\particle.comp", defines, gravityProgramID, shaderArgs);
 }
 
 void renderEnvironment()
@@ -568,41 +902,429 @@ void renderEnvironment()
     glDepthMask(GL_TRUE);
 }
 
+// Sets the uniforms every variant of particle.vert shares on the program in use
+void setParticleUniforms(const ParticleUniforms &uniforms, int interpolation, int width, int height)
+{
+    glUniformMatrix4fv(uniforms.viewMatrix, 1, GL_FALSE, &viewMatrix.cell[0]);
+    glUniformMatrix3fv(uniforms.rotationMatrix, 1, GL_FALSE, &rotationInverse.cell[0]);
+    glUniform1f(uniforms.maxVelocity, VELOCITY_CUTOFF);
+    // without slots the vertex id is the slot
+    glUniform1i(uniforms.permuted, bodySlotBuffer != 0);
+    glUniform1i(uniforms.interpolation, interpolation);
+    glUniform1f(uniforms.alpha, stepPhase);
+    glUniform1f(uniforms.stepTime, DT);
+    glUniform2f(uniforms.viewport, width, height);
+    glUniform1f(uniforms.pixelScale, projMatrix.cell[5] * height / 2);
+    glUniform1f(uniforms.maxSize, renderMaxSize);
+}
+
+void dispatchCull(CullStage stage, int groups)
+{
+    glUniform1i(cullStageID, stage);
+    glDispatchCompute(groups, 1, 1);
+    glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+}
+
+// Runs cull.comp on the drawn generation, which leaves the slots to draw in visibleBuffer and
+// the draws of the billboards and of the points in drawCommandBuffer
+void cullParticles(int width, int height, bool interpolating)
+{
+    bool merging = LOD_MERGE_PIXELS > 0;
+    if (merging && (width != claimWidth || height != claimHeight))
+    {
+        if (pixelClaimBuffer == 0)
+        {
+            glGenBuffers(1, &pixelClaimBuffer);
+        }
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, pixelClaimBuffer);
+        glBufferData(GL_SHADER_STORAGE_BUFFER, sizeof(GLuint) * width * height, nullptr, GL_DYNAMIC_COPY);
+        claimWidth = width;
+        claimHeight = height;
+    }
+
+    // planes of the frustum from the rows of the view projection matrix, facing inwards
+    const float *m = viewMatrix.cell;
+    float frustum[6][4];
+    for (int plane = 0; plane < 6; plane++)
+    {
+        int row = plane / 2;
+        float sign = plane % 2 == 0 ? 1 : -1;
+        float length = 0;
+        for (int column = 0; column < 4; column++)
+        {
+            frustum[plane][column] = m[4 * column + 3] + sign * m[4 * column + row];
+            length += column < 3 ? frustum[plane][column] * frustum[plane][column] : 0;
+        }
+        for (int column = 0; column < 4; column++)
+        {
+            frustum[plane][column] /= sqrt(length);
+        }
+    }
+
+    glUseProgram(cullProgramID);
+    glUniform1ui(cullCountID, PARTICLE_COUNT);
+    glUniform1i(cullPermutedID, bodySlotBuffer != 0);
+    glUniformMatrix4fv(cullMatrixID, 1, GL_FALSE, &viewMatrix.cell[0]);
+    glUniform4fv(cullFrustumID, 6, &frustum[0][0]);
+    glUniform2f(cullViewportID, width, height);
+    glUniform1f(cullPixelScaleID, projMatrix.cell[5] * height / 2);
+    // an interpolated body can be up to a step behind its current position
+    glUniform1f(cullMotionScaleID, interpolating ? DT : 0);
+    glUniform1f(cullPointPixelsID, LOD_POINT_PIXELS);
+    glUniform1f(cullMergePixelsID, LOD_MERGE_PIXELS);
+    glUniform1i(cullInstancedID, RENDERER == "quads");
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 6, visibleBuffer);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 7, groupCountBuffer);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 8, drawCommandBuffer);
+
+    int groups = (PARTICLE_COUNT + CULL_GROUP_SIZE - 1) / CULL_GROUP_SIZE;
+    if (merging)
+    {
+        GLuint unclaimed = 0xffffffff;
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, pixelClaimBuffer);
+        glClearBufferData(GL_SHADER_STORAGE_BUFFER, GL_R32UI, GL_RED_INTEGER, GL_UNSIGNED_INT, &unclaimed);
+        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 9, pixelClaimBuffer);
+        dispatchCull(STAGE_CLAIM, groups);
+    }
+    dispatchCull(STAGE_COUNT, groups);
+    dispatchCull(STAGE_SCAN, 1);
+    dispatchCull(STAGE_SCATTER, groups);
+    glMemoryBarrier(GL_COMMAND_BARRIER_BIT);
+}
+
 void renderParticles()
 {
+    int width, height;
+    glfwGetFramebufferSize(WINDOW, &width, &height);
+
+    int generation = particleRing.current();
+    int mode = INTERPOLATION == "linear" ? 1 : INTERPOLATION == "hermite" ? 2 : 0;
+    int previous = previousValid && mode != 0 ? (generation + RING_SIZE - 1) % RING_SIZE : generation;
+    particleRing.bindInput(previous);
+    particleRing.bindOutput(generation);
+    if (bodySlotBuffer != 0)
+    {
+        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 5, bodySlotBuffer);
+    }
+    if (RENDER_STREAM)
+    {
+        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 10, particleRing.renderStream(generation));
+        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 11, particleRing.renderStream(previous));
+    }
+    if (CULL)
+    {
+        cullParticles(width, height, previous != generation);
+        glBindBuffer(GL_DRAW_INDIRECT_BUFFER, drawCommandBuffer);
+    }
+
     glUseProgram(particleProgramID);
+    setParticleUniforms(particleUniforms, previous != generation ? mode : 0, width, height);
+    if (RENDERER == "quads")
+    {
+        if (CULL)
+        {
+            glDrawArraysIndirect(GL_TRIANGLE_STRIP, 0);
+        }
+        else
+        {
+            glDrawArraysInstanced(GL_TRIANGLE_STRIP, 0, 4, particles.size());
+        }
+    }
+    else if (CULL)
+    {
+        glDrawArraysIndirect(GL_POINTS, 0);
+    }
+    else
+    {
+        glDrawArrays(GL_POINTS, 0, particles.size());
+    }
+    if (CULL)
+    {
+        // the bodies too small for a billboard, the second command
+        glUseProgram(lodPointProgramID);
+        setParticleUniforms(lodPointUniforms, previous != generation ? mode : 0, width, height);
+        glDrawArraysIndirect(GL_POINTS, (const void *)(4 * sizeof(GLuint)));
+        glBindBuffer(GL_DRAW_INDIRECT_BUFFER, 0);
+    }
+    particleRing.fence(generation);
+    if (previous != generation)
+    {
+        particleRing.fence(previous);
+    }
 
-    glUniformMatrix4fv(particleMatrixID, 1, GL_FALSE, &viewMatrix.cell[0]);
-    cy::Vec3f output = rotation * cy::Vec3f(0.1, 0, 0);
-    glUniformMatrix3fv(particleRotationID, 1, GL_FALSE, &rotationInverse.cell[0]);
-    glUniform1f(velocityCutoffID, VELOCITY_CUTOFF);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+}
 
-    glEnableVertexAttribArray(0);
-    glBindBuffer(GL_ARRAY_BUFFER, particleIndexBuffer);
-    glVertexAttribIPointer(0, 1, GL_INT, 0, 0);
+// Advances the cpu engine one step, sorting along the space filling curve every REORDER_INTERVAL steps.
+// Returns true when the bodies moved to new slots.
+bool stepEngine()
+{
+    bool reordered = false;
+    if (reorder != nullptr && stepCount % REORDER_INTERVAL == 0)
+    {
+        reorder->apply(simulatedParticles, bodyIds);
+        integrator->permute(reorder->lastPermutation());
+        reordered = true;
+    }
+    integrator->step(*engine, simulatedParticles);
+    stepCount++;
+    if (checkpointWriter != nullptr && stepCount % CHECKPOINT_INTERVAL == 0)
+    {
+        Checkpoint checkpoint;
+        captureCheckpoint(checkpoint, stepCount);
+        saveCheckpoint(checkpoint, simulatedParticles, bodyIds);
+    }
+    // the host has every step, only the last one of a frame goes to the gpu
+    if (snapshotReader != nullptr && SNAPSHOT_INTERVAL > 0 && stepCount % SNAPSHOT_INTERVAL == 0)
+    {
+        snapshotReader->deliver(stepCount, simulatedParticles, reorder != nullptr ? bodyIds : std::vector<int>());
+    }
+    return reordered;
+}
 
-    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, particleOutputBuffer);
+// Runs one stage of particle.comp over every body
+void dispatchGravity(GravityStage stage, float coefficient)
+{
+    glUniform1i(gravityStageID, stage);
+    glUniform1f(gravityCoefficientID, coefficient);
+    glDispatchCompute((PARTICLE_COUNT + WORKGROUP_SIZE - 1) / WORKGROUP_SIZE, 1, 1);
+    glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+}
 
-    glDrawArrays(GL_POINTS, 0, particles.size());
+// Starts a readback of the newest generation
+void requestSnapshot()
+{
+    int generation = particleRing.current();
+    std::vector<int> slots;
+    if (reorder != nullptr)
+    {
+        slots = bodyIds;
+    }
+    // the consumer thread only adds the particles, the rest of the state is taken here
+    std::shared_ptr<Checkpoint> checkpoint;
+    if (checkpointWriter != nullptr && stepCount % CHECKPOINT_INTERVAL == 0)
+    {
+        checkpoint = std::make_shared<Checkpoint>();
+        captureCheckpoint(*checkpoint, stepCount);
+    }
+    snapshotReader->request(particleRing.bodyBuffer(generation), particleRing.velocityBuffer(generation), stepCount, frameCount, slots,
+                            checkpoint);
+}
 
-    glDisableVertexAttribArray(0);
-    glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+// Whether the compute shader's newest generation should be read back
+bool snapshotDue()
+{
+    bool snapshot = SNAPSHOT_INTERVAL > 0 && stepCount % SNAPSHOT_INTERVAL == 0;
+    // the compute shader's state only reaches the host through snapshots
+    bool checkpoint = checkpointWriter != nullptr && stepCount % CHECKPOINT_INTERVAL == 0;
+    return snapshot || checkpoint;
 }
 
-void runGravity()
+// Fills the generation's render stream from its particles
+void packRenderStream(int generation)
 {
     glUseProgram(gravityProgramID);
+    glUniform1ui(gravityCountID, PARTICLE_COUNT);
+    glUniform1f(gravityMaxVelocityID, VELOCITY_CUTOFF);
+    glUniform1f(gravityMaxSizeID, renderMaxSize);
+    particleRing.bindOutput(generation);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 10, particleRing.renderStream(generation));
+    dispatchGravity(STAGE_PACK, 0);
+}
 
-    // swap the buffers
-    GLuint tmp = particleInputBuffer;
-    particleInputBuffer = particleOutputBuffer;
-    particleOutputBuffer = particleInputBuffer;
+// Runs one step of the compute shader
+void stepGpu()
+{
+    // the step reads the current generation and writes the next, older ones stay untouched
+    // for whoever is still drawing or reading them
+    int source = particleRing.current();
+    int target = particleRing.next();
 
-    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, particleInputBuffer);
-    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, particleOutputBuffer);
+    glUseProgram(gravityProgramID);
+    glUniform1ui(gravityCountID, PARTICLE_COUNT);
+    glUniform1f(gravityTimestepID, DT);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 2, integratorStateBuffer);
 
-    glDispatchCompute(PARTICLE_COUNT, 1, 1);
-    glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+    if (INTEGRATOR != "euler")
+    {
+        // the stages update the target in place, forces are kept between steps
+        particleRing.copy(source, target);
+        particleRing.bindInput(target);
+        particleRing.bindOutput(target);
+
+        if (INTEGRATOR == "leapfrog")
+        {
+            if (!gpuForcesValid)
+            {
+                dispatchGravity(STAGE_ACCELERATION, 0);
+            }
+            dispatchGravity(STAGE_KICK, 0.5);
+            dispatchGravity(STAGE_DRIFT, 1);
+            dispatchGravity(STAGE_ACCELERATION, 0);
+            dispatchGravity(STAGE_KICK, 0.5);
+        }
+        else if (INTEGRATOR == "yoshida")
+        {
+            for (int stage = 0; stage < 3; stage++)
+            {
+                dispatchGravity(STAGE_DRIFT, YOSHIDA_DRIFT[stage]);
+                dispatchGravity(STAGE_ACCELERATION, 0);
+                dispatchGravity(STAGE_KICK, YOSHIDA_KICK[stage]);
+            }
+            dispatchGravity(STAGE_DRIFT, YOSHIDA_DRIFT[3]);
+        }
+        else if (INTEGRATOR == "hermite")
+        {
+            if (!gpuForcesValid)
+            {
+                dispatchGravity(STAGE_ACCELERATION_JERK, 0);
+            }
+            dispatchGravity(STAGE_PREDICT, 0);
+            dispatchGravity(STAGE_ACCELERATION_JERK, 0);
+            dispatchGravity(STAGE_CORRECT, 0);
+        }
+        gpuForcesValid = true;
+    }
+    else
+    {
+        particleRing.bindInput(source);
+        particleRing.bindOutput(target);
+        dispatchGravity(STAGE_EULER, 1);
+    }
+
+    if (RENDER_STREAM)
+    {
+        packRenderStream(target);
+    }
+
+    // the next step copies from the target and the host may read it through the mapping
+    glMemoryBarrier(GL_BUFFER_UPDATE_BARRIER_BIT | GL_CLIENT_MAPPED_BUFFER_BARRIER_BIT);
+    particleRing.fence(target);
+    particleRing.advance();
+    stepCount++;
+}
+
+// Advances the simulation by steps, the renderer then draws the newest generation
+void runGravity(int steps)
+{
+    if (engine != nullptr)
+    {
+        // step on the host and hand the last result to the renderer
+        bool reordered = false;
+        bool lastReordered = false;
+        std::vector<Particle> previousParticles;
+        std::vector<int> previousIds;
+        for (int substep = 0; substep < steps; substep++)
+        {
+            if (INTERPOLATION != "none" && substep == steps - 1)
+            {
+                previousParticles = simulatedParticles;
+                previousIds = bodyIds;
+            }
+            lastReordered = stepEngine();
+            reordered = lastReordered || reordered;
+        }
+        if (reordered)
+        {
+            uploadBodySlots();
+        }
+        // the current generation already holds the step before unless the frame ran several
+        // steps or the last one moved the bodies to other slots
+        if (!previousParticles.empty() && (steps > 1 || lastReordered || !previousValid))
+        {
+            // the step before goes in the generation before, in the slots the bodies have now
+            std::vector<int> previousSlots(previousIds.size());
+            for (size_t slot = 0; slot < previousIds.size(); slot++)
+            {
+                previousSlots[previousIds[slot]] = slot;
+            }
+            std::vector<Particle> ordered(previousParticles.size());
+            for (size_t slot = 0; slot < bodyIds.size(); slot++)
+            {
+                ordered[slot] = previousParticles[previousSlots[bodyIds[slot]]];
+            }
+            particleRing.write(particleRing.next(), ordered);
+            particleRing.advance();
+            if (RENDER_STREAM)
+            {
+                packRenderStream(particleRing.current());
+            }
+        }
+        // straight into the mapping, the fence only waits if the renderer is two frames behind
+        particleRing.write(particleRing.next(), simulatedParticles);
+        particleRing.advance();
+        if (RENDER_STREAM)
+        {
+            packRenderStream(particleRing.current());
+        }
+        previousValid = true;
+        return;
+    }
+
+    for (int substep = 0; substep < steps; substep++)
+    {
+        stepGpu();
+        // later substeps only overwrite the generation after the copy is done
+        if (snapshotReader != nullptr && snapshotDue())
+        {
+            requestSnapshot();
+        }
+    }
+    previousValid = true;
+}
+
+// Runs on the snapshot reader's thread, the render loop never waits for it
+void analyzeSnapshot(const Snapshot &snapshot)
+{
+    // the compute shader's state only reaches the host through snapshots
+    if (snapshot.checkpoint != nullptr)
+    {
+        saveCheckpoint(*snapshot.checkpoint, snapshot.particles, snapshot.bodyIds);
+    }
+    if (SNAPSHOT_INTERVAL == 0 || snapshot.step % SNAPSHOT_INTERVAL != 0)
+    {
+        return;
+    }
+    if (trajectoryWriter != nullptr)
+    {
+        trajectoryWriter->append(snapshot.step, snapshot.particles, snapshot.bodyIds);
+        return;
+    }
+    std::cout << "snapshot of step " << snapshot.step << " (" << snapshot.latency << " frames late): energy "
+              << totalEnergy(snapshot.particles) << std::endl;
+}
+
+// Checks one evaluation of the compute shader against the reference engine.
+// Returns the exit status, 1 when the error is beyond float rounding.
+int validateGravity()
+{
+    glUseProgram(gravityProgramID);
+    glUniform1ui(gravityCountID, PARTICLE_COUNT);
+    glUniform1f(gravityTimestepID, DT);
+    particleRing.bindInput(particleRing.current());
+    particleRing.bindOutput(particleRing.current());
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 2, integratorStateBuffer);
+    dispatchGravity(STAGE_ACCELERATION, 0);
+
+    // the acceleration is the first of the six vec4s of IntegratorState
+    std::vector<cy::Vec4f> states(6 * particles.size());
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, integratorStateBuffer);
+    glGetBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, sizeof(cy::Vec4f) * states.size(), &states[0]);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+
+    std::vector<cy::Vec3f> actual(particles.size());
+    for (size_t i = 0; i < particles.size(); i++)
+    {
+        actual[i] = states[6 * i].XYZ();
+    }
+    ReferenceEngine reference;
+    std::vector<cy::Vec3f> expected(particles.size());
+    reference.computeAccelerations(simulatedParticles, expected);
+
+    AccelerationError error = compareAccelerations(actual, expected);
+    std::cout << "compute shader on " << glGetString(GL_RENDERER) << ", workgroup size " << WORKGROUP_SIZE << std::endl;
+    std::cout << "relative error vs reference: max " << error.max << ", rms " << error.rms << std::endl;
+    return error.max < 1e-4f ? 0 : 1;
 }
 
 // The main render loop
@@ -613,15 +1335,39 @@ void renderLoop()
     glEnable(GL_TEXTURE_CUBE_MAP_SEAMLESS);
     glEnable(GL_BLEND);
     glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+    // point sprites and the culled points size themselves
+    glEnable(GL_PROGRAM_POINT_SIZE);
 
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    std::chrono::steady_clock::time_point lastFrame = start;
+    int startStep = stepCount;
     while (!glfwWindowShouldClose(WINDOW))
     {
         glClearColor(0.0, 0.0, 0.0, 1.0);
         glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
 
-        if (!paused)
+        std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+        double elapsed = std::chrono::duration<double>(now - lastFrame).count();
+        lastFrame = now;
+        if (!paused && SIM_RATE <= 0)
         {
-            runGravity();
+            runGravity(SUBSTEPS);
+        }
+        else if (!paused)
+        {
+            // run the steps the wall clock is due, a quarter second at most so a slow frame
+            // drops time instead of piling up steps
+            double due = std::min(stepPhase + elapsed * SIM_RATE, ceil(SIM_RATE * 0.25));
+            int steps = (int)due;
+            stepPhase = due - steps;
+            if (steps > 0)
+            {
+                runGravity(steps);
+            }
+        }
+        if (snapshotReader != nullptr)
+        {
+            snapshotReader->poll(frameCount);
         }
         renderEnvironment();
         renderParticles();
@@ -629,18 +1375,471 @@ void renderLoop()
         glfwSwapBuffers(WINDOW);
 
         glfwPollEvents();
-        usleep(16000);
+        if (!MAX_THROUGHPUT)
+        {
+            usleep(16000);
+        }
+        frameCount++;
+        if (frameCount == FRAME_LIMIT)
+        {
+            glfwSetWindowShouldClose(WINDOW, GL_TRUE);
+        }
+    }
+
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    std::cout << frameCount << " frames in " << seconds << " s, " << frameCount / seconds << " frames/s, "
+              << 1000 * seconds / frameCount << " ms/frame, " << (stepCount - startStep) / seconds << " steps/s" << std::endl;
+}
+
+// Waits for the last frames to reach the trajectory file and reports its size
+void finishRecording()
+{
+    trajectoryWriter->close();
+    long long written = trajectoryWriter->bytesWritten();
+    std::cout << "recorded " << trajectoryWriter->framesWritten() << " frames to " << RECORD_PATH << ", "
+              << written / 1048576.0 << " MB, " << (double)trajectoryWriter->rawBytes() / written << "x smaller than plain floats" << std::endl;
+    delete trajectoryWriter;
+    trajectoryWriter = nullptr;
+}
+
+// Waits for the checkpoint being written and reports how many made it to disk
+void finishCheckpoints()
+{
+    if (checkpointWriter == nullptr)
+    {
+        return;
+    }
+    checkpointWriter->close();
+    std::cout << "checkpoints: " << checkpointWriter->written << " written to " << CHECKPOINT_PATH << ", "
+              << checkpointWriter->dropped << " skipped while the one before was still being written" << std::endl;
+    delete checkpointWriter;
+    checkpointWriter = nullptr;
+}
+
+// Runs the selected cpu engine without ever creating a window or touching GL
+void runHeadless()
+{
+    generateParticles();
+
+    std::cout << "engine " << engine->name() << ", integrator " << integrator->name() << ", " << PARTICLE_COUNT << " particles, " << STEP_COUNT << " steps" << std::endl;
+
+    if (VALIDATE)
+    {
+        // check the first step's forces against the straight shader port
+        ReferenceEngine reference;
+        std::vector<cy::Vec3f> expected(simulatedParticles.size());
+        std::vector<cy::Vec3f> actual(simulatedParticles.size());
+        reference.computeAccelerations(simulatedParticles, expected);
+        engine->computeAccelerations(simulatedParticles, actual);
+        engine->interactions = 0;
+
+        AccelerationError error = compareAccelerations(actual, expected);
+        std::cout << "relative error vs reference: max " << error.max << ", rms " << error.rms << std::endl;
+    }
+    double startEnergy = VALIDATE ? totalEnergy(simulatedParticles) : 0;
+
+    if (!RECORD_PATH.empty())
+    {
+        trajectoryWriter = createTrajectoryWriter(trajectoryConfig, RECORD_PATH, PARTICLE_COUNT, DT);
+        trajectoryWriter->append(stepCount, simulatedParticles, bodyIds);
+    }
+
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    for (int i = 0; i < STEP_COUNT; i++)
+    {
+        stepEngine();
+        if (trajectoryWriter != nullptr && stepCount % SNAPSHOT_INTERVAL == 0)
+        {
+            trajectoryWriter->append(stepCount, simulatedParticles, bodyIds);
+        }
+    }
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    std::cout << "elapsed " << seconds << " s, "
+              << STEP_COUNT / seconds << " steps/s, "
+              << engine->interactions / seconds << " interactions/s" << std::endl;
+    std::cout << (double)integrator->bodyEvaluations / ((double)STEP_COUNT * PARTICLE_COUNT)
+              << " force evaluations per body per step" << std::endl;
+    if (VALIDATE)
+    {
+        double endEnergy = totalEnergy(simulatedParticles);
+        std::cout << "relative energy drift: " << fabs((endEnergy - startEnergy) / startEnergy) << std::endl;
+    }
+    if (trajectoryWriter != nullptr)
+    {
+        finishRecording();
+    }
+}
+
+// Reads --option=value style arguments into the global settings
+void parseArguments(int argc, char *argv[])
+{
+    bool engineSelected = false;
+    for (int i = 1; i < argc; i++)
+    {
+        std::string arg = argv[i];
+        std::string value;
+        size_t split = arg.find('=');
+        if (split != std::string::npos)
+        {
+            value = arg.substr(split + 1);
+            arg = arg.substr(0, split);
+        }
+
+        if (arg == "--headless")
+        {
+            HEADLESS = true;
+        }
+        else if (arg == "--engine")
+        {
+            engineConfig.engine = value;
+            engineSelected = true;
+        }
+        else if (arg == "--simd")
+        {
+            engineConfig.simd = value;
+        }
+        else if (arg == "--threads")
+        {
+            engineConfig.threads = atoi(value.c_str());
+        }
+        else if (arg == "--tile-size")
+        {
+            engineConfig.tileSize = atoi(value.c_str());
+        }
+        else if (arg == "--affinity")
+        {
+            engineConfig.affinity = value;
+        }
+        else if (arg == "--symmetric")
+        {
+            engineConfig.symmetric = true;
+        }
+        else if (arg == "--theta")
+        {
+            engineConfig.theta = atof(value.c_str());
+        }
+        else if (arg == "--leaf-size")
+        {
+            engineConfig.leafSize = atoi(value.c_str());
+        }
+        else if (arg == "--quadrupole")
+        {
+            engineConfig.quadrupole = true;
+        }
+        else if (arg == "--order")
+        {
+            engineConfig.fmmOrder = atoi(value.c_str());
+        }
+        else if (arg == "--mesh-size")
+        {
+            engineConfig.meshSize = atoi(value.c_str());
+        }
+        else if (arg == "--boundary")
+        {
+            engineConfig.boundary = value;
+        }
+        else if (arg == "--split")
+        {
+            engineConfig.splitScale = atof(value.c_str());
+        }
+        else if (arg == "--reorder")
+        {
+            REORDER_CURVE = value;
+        }
+        else if (arg == "--reorder-every")
+        {
+            REORDER_INTERVAL = std::max(1, atoi(value.c_str()));
+        }
+        else if (arg == "--integrator")
+        {
+            INTEGRATOR = value;
+        }
+        else if (arg == "--levels")
+        {
+            TIMESTEP_LEVELS = atoi(value.c_str());
+        }
+        else if (arg == "--eta")
+        {
+            TIMESTEP_ETA = atof(value.c_str());
+        }
+        else if (arg == "--dt")
+        {
+            DT = atof(value.c_str());
+        }
+        else if (arg == "--workgroup-size")
+        {
+            WORKGROUP_SIZE = std::max(1, std::min(atoi(value.c_str()), 1024));
+        }
+        else if (arg == "--snapshot-every")
+        {
+            SNAPSHOT_INTERVAL = std::max(0, atoi(value.c_str()));
+        }
+        else if (arg == "--record")
+        {
+            RECORD_PATH = value;
+        }
+        else if (arg == "--record-format")
+        {
+            trajectoryConfig.format = value;
+        }
+        else if (arg == "--chunk-frames")
+        {
+            trajectoryConfig.chunkFrames = std::max(1, atoi(value.c_str()));
+        }
+        else if (arg == "--lossy")
+        {
+            if (!parseFieldGroups(value, trajectoryConfig.lossyFields))
+            {
+                std::cerr << "Unknown fields in --lossy: " << value << ", use position, velocity or mass" << std::endl;
+                exit(1);
+            }
+        }
+        else if (arg == "--error-bound")
+        {
+            trajectoryConfig.errorBound = atof(value.c_str());
+        }
+        else if (arg == "--load")
+        {
+            LOAD_PATH = value;
+        }
+        else if (arg == "--load-frame")
+        {
+            LOAD_FRAME = atoll(value.c_str());
+        }
+        else if (arg == "--checkpoint")
+        {
+            CHECKPOINT_PATH = value;
+        }
+        else if (arg == "--checkpoint-every")
+        {
+            CHECKPOINT_INTERVAL = std::max(0, atoi(value.c_str()));
+        }
+        else if (arg == "--restart")
+        {
+            RESTART_PATH = value;
+        }
+        else if (arg == "--seed")
+        {
+            rng.seed(strtoul(value.c_str(), nullptr, 10));
+        }
+        else if (arg == "--substeps")
+        {
+            SUBSTEPS = std::max(1, atoi(value.c_str()));
+        }
+        else if (arg == "--max-throughput")
+        {
+            MAX_THROUGHPUT = true;
+        }
+        else if (arg == "--frames")
+        {
+            FRAME_LIMIT = std::max(0, atoi(value.c_str()));
+        }
+        else if (arg == "--renderer")
+        {
+            if (value != "geometry" && value != "quads" && value != "points")
+            {
+                std::cerr << "Unknown renderer: " << value << std::endl;
+                exit(1);
+            }
+            RENDERER = value;
+        }
+        else if (arg == "--cull")
+        {
+            CULL = true;
+        }
+        else if (arg == "--lod-point")
+        {
+            LOD_POINT_PIXELS = std::max(0.0, atof(value.c_str()));
+        }
+        else if (arg == "--lod-merge")
+        {
+            LOD_MERGE_PIXELS = std::max(0.0, atof(value.c_str()));
+        }
+        else if (arg == "--render-stream")
+        {
+            RENDER_STREAM = true;
+        }
+        else if (arg == "--sim-rate")
+        {
+            SIM_RATE = std::max(0.0, atof(value.c_str()));
+        }
+        else if (arg == "--interpolate")
+        {
+            if (value != "none" && value != "linear" && value != "hermite")
+            {
+                std::cerr << "Unknown interpolation: " << value << std::endl;
+                exit(1);
+            }
+            INTERPOLATION = value;
+        }
+        else if (arg == "--layout")
+        {
+            if (!particleLayout.select(value))
+            {
+                std::cerr << "Unknown particle layout: " << value << std::endl;
+                exit(1);
+            }
+        }
+        else if (arg == "--validate")
+        {
+            VALIDATE = true;
+        }
+        else if (arg == "--particles")
+        {
+            PARTICLE_COUNT = atoi(value.c_str());
+        }
+        else if (arg == "--steps")
+        {
+            STEP_COUNT = atoi(value.c_str());
+        }
+        else
+        {
+            std::cerr << "Unknown argument: " << argv[i] << std::endl;
+            exit(1);
+        }
+    }
+
+    // recording goes through the snapshots, so it needs an interval
+    if (!RECORD_PATH.empty() && SNAPSHOT_INTERVAL == 0)
+    {
+        SNAPSHOT_INTERVAL = 16;
+    }
+    if (!CHECKPOINT_PATH.empty() && CHECKPOINT_INTERVAL == 0)
+    {
+        CHECKPOINT_INTERVAL = 1000;
+    }
+    if (trajectoryConfig.format != "raw" && trajectoryConfig.format != "deflate")
+    {
+        std::cerr << "Unknown trajectory format: " << trajectoryConfig.format << std::endl;
+        exit(1);
+    }
+    if (trajectoryConfig.lossyFields != 0 && trajectoryConfig.format != "deflate")
+    {
+        std::cerr << "Lossy fields are only stored in deflate trajectories, using --record-format=deflate" << std::endl;
+        trajectoryConfig.format = "deflate";
+    }
+    trajectoryConfig.threads = engineConfig.threads;
+
+    // the compute shader is the default when there is a window to run it in
+    if (!engineSelected)
+    {
+        engineConfig.engine = HEADLESS ? "reference" : "gpu";
+    }
+    if (engineConfig.engine != "gpu")
+    {
+        engine = createEngine(engineConfig);
+        if (engine == nullptr)
+        {
+            std::cerr << "Unknown engine: " << engineConfig.engine << std::endl;
+            exit(1);
+        }
+    }
+    else if (HEADLESS)
+    {
+        std::cerr << "The gpu engine needs a window, pick a cpu engine with --engine" << std::endl;
+        exit(1);
+    }
+
+    integrator = createIntegrator(INTEGRATOR, DT);
+    if (integrator == nullptr)
+    {
+        std::cerr << "Unknown integrator: " << INTEGRATOR << std::endl;
+        exit(1);
+    }
+    if (TIMESTEP_LEVELS > 0)
+    {
+        if (engine == nullptr)
+        {
+            std::cerr << "Block time steps only apply to cpu engines, ignoring --levels" << std::endl;
+        }
+        else
+        {
+            if (INTEGRATOR != "euler")
+            {
+                std::cerr << "Block time steps kick like euler, ignoring --integrator" << std::endl;
+            }
+            delete integrator;
+            integrator = new BlockTimestepper(TIMESTEP_LEVELS, TIMESTEP_ETA, DT);
+        }
+    }
+    // the jerk has no tree or mesh version, these engines only speed up the other integrators
+    if (INTEGRATOR == "hermite" && TIMESTEP_LEVELS == 0 &&
+        (engineConfig.engine == "barneshut" || engineConfig.engine == "fmm" || engineConfig.engine == "pm" || engineConfig.engine == "p3m"))
+    {
+        std::cerr << "The hermite integrator sums every pair directly, " << engineConfig.engine
+                  << " runs at O(N^2) with it, --engine=tiled spreads that sum over the threads" << std::endl;
+    }
+
+    if (REORDER_CURVE != "none")
+    {
+        if (engine == nullptr)
+        {
+            std::cerr << "Reordering only applies to cpu engines, ignoring --reorder" << std::endl;
+        }
+        else
+        {
+            reorder = new SpatialReorder(REORDER_CURVE, engineConfig.threads);
+        }
     }
 }
 
 int main(int argc, char *argv[])
 {
+    parseArguments(argc, argv);
+    if (!CHECKPOINT_PATH.empty())
+    {
+        checkpointWriter = new CheckpointWriter(CHECKPOINT_PATH);
+    }
+    if (HEADLESS)
+    {
+        runHeadless();
+        finishCheckpoints();
+        return 0;
+    }
+
     initWindow();
+    if (VALIDATE && engine == nullptr)
+    {
+        loadGravityShader();
+        initParticles();
+        return validateGravity();
+    }
     initViewMatrix();
     loadParticleShader();
     loadGravityShader();
+    if (CULL)
+    {
+        loadCullShader();
+    }
     loadEnvShader();
     initParticles();
     initEnv();
+    if (SNAPSHOT_INTERVAL > 0 || (checkpointWriter != nullptr && engine == nullptr))
+    {
+        if (!RECORD_PATH.empty())
+        {
+            trajectoryWriter = createTrajectoryWriter(trajectoryConfig, RECORD_PATH, PARTICLE_COUNT, DT);
+        }
+        snapshotReader = new SnapshotReader(&particleLayout, PARTICLE_COUNT, analyzeSnapshot);
+        if (SNAPSHOT_INTERVAL > 0)
+        {
+            requestSnapshot();
+        }
+    }
     renderLoop();
+
+    if (snapshotReader != nullptr)
+    {
+        long long delivered = snapshotReader->delivered;
+        std::cout << "snapshots: " << delivered << " delivered, " << snapshotReader->dropped << " dropped, latency "
+                  << (delivered > 0 ? (double)snapshotReader->totalLatency / delivered : 0) << " frames on average, "
+                  << snapshotReader->maxLatency << " at most" << std::endl;
+        delete snapshotReader;
+    }
+    if (trajectoryWriter != nullptr)
+    {
+        finishRecording();
+    }
+    finishCheckpoints();
 }
\ No newline at end of file
@@ -0,0 +1,162 @@
+#include <nbody.h>
+#include <simdEngine.h>
+#include <tiledEngine.h>
+#include <barnesHutEngine.h>
+#include <fmmEngine.h>
+#include <pmEngine.h>
+#include <p3mEngine.h>
+#include <math.h>
+
+void NBodyEngine::step(std::vector<Particle> &particles)
+{
+    accelerations.resize(particles.size());
+    computeAccelerations(particles, accelerations);
+
+    for (size_t i = 0; i < particles.size(); i++)
+    {
+        Particle &p = particles[i];
+        p.vel = cy::Vec4f(p.vel.x + accelerations[i].x, p.vel.y + accelerations[i].y, p.vel.z + accelerations[i].z, 0);
+        p.pos = cy::Vec4f(p.pos.x + p.vel.x, p.pos.y + p.vel.y, p.pos.z + p.vel.z, p.pos.w);
+    }
+}
+
+void NBodyEngine::computeActiveAccelerations(const std::vector<Particle> &particles, const std::vector<int> &active, std::vector<cy::Vec3f> &acc)
+{
+    activeScratch.resize(particles.size());
+    computeAccelerations(particles, activeScratch);
+    for (size_t i = 0; i < active.size(); i++)
+    {
+        acc[active[i]] = activeScratch[active[i]];
+    }
+}
+
+void NBodyEngine::computeAccelerationsAndJerks(const std::vector<Particle> &particles, std::vector<cy::Vec3f> &acc, std::vector<cy::Vec3f> &jerk)
+{
+    int count = particles.size();
+    for (int id = 0; id < count; id++)
+    {
+        calcAccelerationAndJerk(particles, id, acc[id], jerk[id]);
+    }
+    interactions += (long long)count * (count - 1);
+}
+
+void NBodyEngine::calcAccelerationAndJerk(const std::vector<Particle> &particles, int id, cy::Vec3f &acc, cy::Vec3f &jerk) const
+{
+    int count = particles.size();
+    cy::Vec3f a(0, 0, 0);
+    cy::Vec3f j(0, 0, 0);
+    for (int i = 0; i < count; i++)
+    {
+        cy::Vec3f delta = particles[i].pos.XYZ() - particles[id].pos.XYZ();
+        float dist2 = delta.Dot(delta);
+        if (i == id || dist2 == 0)
+        {
+            continue;
+        }
+        cy::Vec3f deltaVel = particles[i].vel.XYZ() - particles[id].vel.XYZ();
+        float r2 = fmaxf(dist2, MIN_DISTANCE_SQUARED);
+        float dist = sqrtf(dist2);
+        float force = GRAVITY * particles[id].mass() * particles[i].mass() / r2;
+        a += force * (delta / dist);
+
+        // d/dt of delta / (r2 * dist), r2 is a constant inside the clamp
+        float rv = delta.Dot(deltaVel) / dist2;
+        float power = dist2 < MIN_DISTANCE_SQUARED ? 1.0f : 3.0f;
+        j += force * ((deltaVel - power * rv * delta) / dist);
+    }
+    acc = a;
+    jerk = j;
+}
+
+cy::Vec3f ReferenceEngine::calcAcceleration(const std::vector<Particle> &particles, int id) const
+{
+    int count = particles.size();
+    cy::Vec3f result(0, 0, 0);
+    for (int i = 0; i < count; i++)
+    {
+        if (i == id)
+        {
+            continue;
+        }
+        cy::Vec3f delta = particles[i].pos.XYZ() - particles[id].pos.XYZ();
+        float dist2 = delta.Dot(delta);
+        float r2 = fmaxf(dist2, MIN_DISTANCE_SQUARED);
+        float force = GRAVITY * particles[id].mass() * particles[i].mass() / r2;
+        result += force * (delta / sqrtf(dist2));
+    }
+    return result;
+}
+
+void ReferenceEngine::computeAccelerations(const std::vector<Particle> &particles, std::vector<cy::Vec3f> &acc)
+{
+    int count = particles.size();
+    for (int id = 0; id < count; id++)
+    {
+        acc[id] = calcAcceleration(particles, id);
+    }
+    interactions += (long long)count * (count - 1);
+}
+
+void ReferenceEngine::computeActiveAccelerations(const std::vector<Particle> &particles, const std::vector<int> &active, std::vector<cy::Vec3f> &acc)
+{
+    for (size_t i = 0; i < active.size(); i++)
+    {
+        acc[active[i]] = calcAcceleration(particles, active[i]);
+    }
+    interactions += (long long)active.size() * (particles.size() - 1);
+}
+
+AccelerationError compareAccelerations(const std::vector<cy::Vec3f> &acc, const std::vector<cy::Vec3f> &reference)
+{
+    AccelerationError error = {0, 0};
+    double sum = 0;
+    for (size_t i = 0; i < reference.size(); i++)
+    {
+        float length = reference[i].Length();
+        if (length == 0)
+        {
+            continue;
+        }
+        float relative = (acc[i] - reference[i]).Length() / length;
+        error.max = fmaxf(error.max, relative);
+        sum += relative * relative;
+    }
+    if (!reference.empty())
+    {
+        error.rms = sqrt(sum / reference.size());
+    }
+    return error;
+}
+
+NBodyEngine *createEngine(const EngineConfig &config)
+{
+    if (config.engine == "reference")
+    {
+        return new ReferenceEngine();
+    }
+    if (config.engine == "simd")
+    {
+        return new SimdEngine(config);
+    }
+    if (config.engine == "tiled")
+    {
+        return new TiledEngine(config);
+    }
+    if (config.engine == "barneshut")
+    {
+        return new BarnesHutEngine(config);
+    }
+    if (config.engine == "fmm")
+    {
+        return new FmmEngine(config);
+    }
+    if (config.engine == "pm")
+    {
+        return new PmEngine(config);
+    }
+    if (config.engine == "p3m")
+    {
+        return new P3mEngine(config);
+    }
+    return nullptr;
+}
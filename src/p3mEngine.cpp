@@ -0,0 +1,157 @@
+#include <p3mEngine.h>
+#include <algorithm>
+#include <math.h>
+#include <stdio.h>
+
+// erfc(r / 2s) has dropped to 0.15% at 4.5s
+const float CUTOFF_SCALES = 4.5f;
+
+// keeps the cell list from growing without bound on very spread out systems
+const int MAX_CELLS_PER_AXIS = 256;
+
+P3mEngine::P3mEngine(const EngineConfig &config) : PmEngine(config)
+{
+    splitScale = std::max(0.5f, config.splitScale);
+    threadInteractions.resize(pool.size());
+
+    char description[128];
+    snprintf(description, sizeof(description), "p3m (mesh %d, %s, split %.2f cells, %d threads)", meshSize, isolated ? "isolated" : "periodic", splitScale, pool.size());
+    engineName = description;
+}
+
+void P3mEngine::binBodies(const std::vector<Particle> &particles, float cutoff)
+{
+    int count = particles.size();
+    float minimum[3], maximum[3];
+    for (int axis = 0; axis < 3; axis++)
+    {
+        minimum[axis] = maximum[axis] = count > 0 ? particles[0].pos[axis] : 0;
+    }
+    for (int i = 0; i < count; i++)
+    {
+        for (int axis = 0; axis < 3; axis++)
+        {
+            minimum[axis] = std::min(minimum[axis], particles[i].pos[axis]);
+            maximum[axis] = std::max(maximum[axis], particles[i].pos[axis]);
+        }
+    }
+
+    // cells at least as wide as the cutoff so only the 27 neighbours matter
+    float extent = 0;
+    for (int axis = 0; axis < 3; axis++)
+    {
+        extent = std::max(extent, maximum[axis] - minimum[axis]);
+    }
+    cellWidth = std::max(cutoff, extent / MAX_CELLS_PER_AXIS);
+    for (int axis = 0; axis < 3; axis++)
+    {
+        cellOrigin[axis] = minimum[axis];
+        cellCounts[axis] = std::max(1, (int)((maximum[axis] - minimum[axis]) / cellWidth) + 1);
+    }
+
+    size_t cellTotal = (size_t)cellCounts[0] * cellCounts[1] * cellCounts[2];
+    std::vector<int> bodyCell(count);
+    cellStart.assign(cellTotal + 1, 0);
+    for (int i = 0; i < count; i++)
+    {
+        int c[3];
+        for (int axis = 0; axis < 3; axis++)
+        {
+            c[axis] = std::min(cellCounts[axis] - 1, (int)((particles[i].pos[axis] - cellOrigin[axis]) / cellWidth));
+        }
+        bodyCell[i] = (c[2] * cellCounts[1] + c[1]) * cellCounts[0] + c[0];
+        cellStart[bodyCell[i] + 1]++;
+    }
+    for (size_t c = 0; c < cellTotal; c++)
+    {
+        cellStart[c + 1] += cellStart[c];
+    }
+
+    std::vector<int> fill(cellStart.begin(), cellStart.end() - 1);
+    order.resize(count);
+    x.resize(count);
+    y.resize(count);
+    z.resize(count);
+    mass.resize(count);
+    for (int i = 0; i < count; i++)
+    {
+        int s = fill[bodyCell[i]]++;
+        order[s] = i;
+        x[s] = particles[i].pos.x;
+        y[s] = particles[i].pos.y;
+        z[s] = particles[i].pos.z;
+        mass[s] = particles[i].mass();
+    }
+}
+
+void P3mEngine::computeAccelerations(const std::vector<Particle> &particles, std::vector<cy::Vec3f> &acc)
+{
+    computeMeshField(particles);
+
+    float split = splitScale * cellSize;
+    float cutoff = CUTOFF_SCALES * split;
+    binBodies(particles, cutoff);
+    std::fill(threadInteractions.begin(), threadInteractions.end(), 0);
+
+    float cutoff2 = cutoff * cutoff;
+    float inverseTwoSplit = 1.0f / (2 * split);
+    float gaussianScale = 1.0f / (split * sqrtf(M_PI));
+    int cellsXY = cellCounts[0] * cellCounts[1];
+
+    // one task per z slab of cells, every body only writes its own result
+    pool.parallelFor(cellCounts[2], [&](int cz, int thread) {
+        long long evaluated = 0;
+        for (int cy = 0; cy < cellCounts[1]; cy++)
+        {
+            for (int cx = 0; cx < cellCounts[0]; cx++)
+            {
+                int cell = cz * cellsXY + cy * cellCounts[0] + cx;
+                for (int i = cellStart[cell]; i < cellStart[cell + 1]; i++)
+                {
+                    float sumX = 0, sumY = 0, sumZ = 0;
+                    for (int nz = std::max(0, cz - 1); nz <= std::min(cellCounts[2] - 1, cz + 1); nz++)
+                    {
+                        for (int ny = std::max(0, cy - 1); ny <= std::min(cellCounts[1] - 1, cy + 1); ny++)
+                        {
+                            int row = nz * cellsXY + ny * cellCounts[0];
+                            int begin = cellStart[row + std::max(0, cx - 1)];
+                            int end = cellStart[row + std::min(cellCounts[0] - 1, cx + 1) + 1];
+                            for (int j = begin; j < end; j++)
+                            {
+                                float dx = x[j] - x[i];
+                                float dy = y[j] - y[i];
+                                float dz = z[j] - z[i];
+                                float d2 = dx * dx + dy * dy + dz * dz;
+                                if (d2 == 0 || d2 >= cutoff2)
+                                {
+                                    continue;
+                                }
+                                // exact clamped pair force minus what the mesh already carries
+                                float r = sqrtf(d2);
+                                float invR = 1.0f / r;
+                                float exact = invR / std::max(d2, MIN_DISTANCE_SQUARED);
+                                float u = r * inverseTwoSplit;
+                                float longRange = erff(u) * invR * invR * invR - gaussianScale * expf(-u * u) * invR * invR;
+                                float s = mass[j] * (exact - longRange);
+                                sumX += s * dx;
+                                sumY += s * dy;
+                                sumZ += s * dz;
+                            }
+                            evaluated += end - begin;
+                        }
+                    }
+
+                    int p = order[i];
+                    float gm = GRAVITY * mass[i];
+                    acc[p] = cy::Vec3f(gm * (meshX[p] + sumX), gm * (meshY[p] + sumY), gm * (meshZ[p] + sumZ));
+                }
+            }
+        }
+        threadInteractions[thread] += evaluated;
+    });
+
+    for (size_t i = 0; i < threadInteractions.size(); i++)
+    {
+        interactions += threadInteractions[i];
+    }
+}
@@ -0,0 +1,153 @@
+#include <particleLayout.h>
+#include <string.h>
+
+static const char *PARTICLE_LAYOUT_PRAGMA = "#pragma particle_layout";
+
+static const char *COMPACT_SOURCE =
+    "layout(std430, binding = 0) buffer particleInputBuffer{\n"
+    "    vec4 bodies[];\n"
+    "} inBuffer;\n"
+    "layout(std430, binding = 1) buffer particleOutputBuffer{\n"
+    "    vec4 bodies[];\n"
+    "} outBuffer;\n"
+    "layout(std430, binding = 3) buffer velocityInputBuffer{\n"
+    "    vec4 velocities[];\n"
+    "} inVelocityBuffer;\n"
+    "layout(std430, binding = 4) buffer velocityOutputBuffer{\n"
+    "    vec4 velocities[];\n"
+    "} outVelocityBuffer;\n"
+    "\n"
+    "vec3 inputPos(uint i){ return inBuffer.bodies[i].xyz; }\n"
+    "float inputMass(uint i){ return inBuffer.bodies[i].w; }\n"
+    "vec3 inputVel(uint i){ return inVelocityBuffer.velocities[i].xyz; }\n"
+    "vec3 outputPos(uint i){ return outBuffer.bodies[i].xyz; }\n"
+    "float outputMass(uint i){ return outBuffer.bodies[i].w; }\n"
+    "vec3 outputVel(uint i){ return outVelocityBuffer.velocities[i].xyz; }\n"
+    "void storePos(uint i, vec3 pos){ outBuffer.bodies[i].xyz = pos; }\n"
+    "void storeMass(uint i, float mass){ outBuffer.bodies[i].w = mass; }\n"
+    "void storeVel(uint i, vec3 vel){ outVelocityBuffer.velocities[i] = vec4(vel, 0); }\n";
+
+static const char *WIDE_SOURCE =
+    "struct Particle {\n"
+    "    vec4 pos;\n"
+    "    vec4 vel;\n"
+    "    double mass;\n"
+    "    double padding;\n"
+    "};\n"
+    "\n"
+    "layout(std430, binding = 0) buffer particleInputBuffer{\n"
+    "    Particle particles[];\n"
+    "} inBuffer;\n"
+    "layout(std430, binding = 1) buffer particleOutputBuffer{\n"
+    "    Particle particles[];\n"
+    "} outBuffer;\n"
+    "\n"
+    "vec3 inputPos(uint i){ return inBuffer.particles[i].pos.xyz; }\n"
+    "float inputMass(uint i){ return float(inBuffer.particles[i].mass); }\n"
+    "vec3 inputVel(uint i){ return inBuffer.particles[i].vel.xyz; }\n"
+    "vec3 outputPos(uint i){ return outBuffer.particles[i].pos.xyz; }\n"
+    "float outputMass(uint i){ return float(outBuffer.particles[i].mass); }\n"
+    "vec3 outputVel(uint i){ return outBuffer.particles[i].vel.xyz; }\n"
+    "void storePos(uint i, vec3 pos){ outBuffer.particles[i].pos = vec4(pos, 0); }\n"
+    "void storeMass(uint i, float mass){ outBuffer.particles[i].mass = double(mass); }\n"
+    "void storeVel(uint i, vec3 vel){ outBuffer.particles[i].vel = vec4(vel, 0); }\n";
+
+bool ParticleLayout::select(const std::string &name)
+{
+    if (name == "compact")
+    {
+        compact = true;
+        return true;
+    }
+    if (name == "wide")
+    {
+        compact = false;
+        return true;
+    }
+    return false;
+}
+
+size_t ParticleLayout::bodyStride() const
+{
+    return compact ? sizeof(cy::Vec4f) : sizeof(WideParticle);
+}
+
+size_t ParticleLayout::velocityStride() const
+{
+    return compact ? sizeof(cy::Vec4f) : 0;
+}
+
+std::string ParticleLayout::source() const
+{
+    return compact ? COMPACT_SOURCE : WIDE_SOURCE;
+}
+
+std::string ParticleLayout::inject(const std::string &shader) const
+{
+    std::string result = shader;
+    size_t at = result.find(PARTICLE_LAYOUT_PRAGMA);
+    if (at != std::string::npos)
+    {
+        result.replace(at, strlen(PARTICLE_LAYOUT_PRAGMA), source());
+    }
+    return result;
+}
+
+void ParticleLayout::pack(const std::vector<Particle> &particles)
+{
+    if (compact)
+    {
+        compactBodies.resize(particles.size());
+        compactVelocities.resize(particles.size());
+        for (size_t i = 0; i < particles.size(); i++)
+        {
+            compactBodies[i] = particles[i].pos;
+            compactVelocities[i] = particles[i].vel;
+        }
+    }
+    else
+    {
+        wideBodies.resize(particles.size());
+        for (size_t i = 0; i < particles.size(); i++)
+        {
+            WideParticle &p = wideBodies[i];
+            p.pos = cy::Vec4f(particles[i].pos.XYZ(), 0);
+            p.vel = particles[i].vel;
+            p.mass = particles[i].mass();
+            p.padding = 0;
+        }
+    }
+}
+
+const void *ParticleLayout::bodies() const
+{
+    return compact ? (const void *)compactBodies.data() : (const void *)wideBodies.data();
+}
+
+const void *ParticleLayout::velocities() const
+{
+    return compact ? (const void *)compactVelocities.data() : nullptr;
+}
+
+void ParticleLayout::unpack(const void *bodies, const void *velocities, std::vector<Particle> &particles) const
+{
+    if (compact)
+    {
+        const cy::Vec4f *body = (const cy::Vec4f *)bodies;
+        const cy::Vec4f *velocity = (const cy::Vec4f *)velocities;
+        for (size_t i = 0; i < particles.size(); i++)
+        {
+            particles[i].pos = body[i];
+            particles[i].vel = velocity[i];
+        }
+    }
+    else
+    {
+        const WideParticle *body = (const WideParticle *)bodies;
+        for (size_t i = 0; i < particles.size(); i++)
+        {
+            particles[i].pos = cy::Vec4f(body[i].pos.XYZ(), (float)body[i].mass);
+            particles[i].vel = body[i].vel;
+        }
+    }
+}
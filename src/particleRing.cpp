@@ -0,0 +1,142 @@
+#include <particleRing.h>
+#include <string.h>
+
+// Persistent and coherent, so neither side has to flush or remap
+static const GLbitfield RING_STORAGE_FLAGS = GL_MAP_READ_BIT | GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+
+// Creates an immutable buffer filled with data and maps it for good
+static GLuint createMappedBuffer(size_t bytes, const void *data, void *&mapped)
+{
+    GLuint buffer;
+    glGenBuffers(1, &buffer);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, buffer);
+    glBufferStorage(GL_SHADER_STORAGE_BUFFER, bytes, data, RING_STORAGE_FLAGS);
+    mapped = glMapBufferRange(GL_SHADER_STORAGE_BUFFER, 0, bytes, RING_STORAGE_FLAGS);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+    return buffer;
+}
+
+void ParticleRing::init(ParticleLayout *layout, const std::vector<Particle> &particles)
+{
+    this->layout = layout;
+    count = particles.size();
+    currentGeneration = 0;
+
+    layout->pack(particles);
+    for (int g = 0; g < RING_SIZE; g++)
+    {
+        bodies[g] = createMappedBuffer(layout->bodyStride() * count, layout->bodies(), mappedBodies[g]);
+        if (layout->velocityStride() > 0)
+        {
+            velocities[g] = createMappedBuffer(layout->velocityStride() * count, layout->velocities(), mappedVelocities[g]);
+        }
+    }
+}
+
+void ParticleRing::initRenderStreams()
+{
+    // only the gpu ever touches them
+    for (int g = 0; g < RING_SIZE; g++)
+    {
+        glGenBuffers(1, &streams[g]);
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, streams[g]);
+        glBufferStorage(GL_SHADER_STORAGE_BUFFER, RENDER_STREAM_STRIDE * count, nullptr, 0);
+    }
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+}
+
+GLuint ParticleRing::velocityBuffer(int generation) const
+{
+    return layout->velocityStride() > 0 ? velocities[generation] : bodies[generation];
+}
+
+void ParticleRing::bindInput(int generation) const
+{
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, bodyBuffer(generation));
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 3, velocityBuffer(generation));
+}
+
+void ParticleRing::bindOutput(int generation) const
+{
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, bodyBuffer(generation));
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 4, velocityBuffer(generation));
+}
+
+void ParticleRing::copy(int source, int target) const
+{
+    glBindBuffer(GL_COPY_READ_BUFFER, bodies[source]);
+    glBindBuffer(GL_COPY_WRITE_BUFFER, bodies[target]);
+    glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, 0, 0, layout->bodyStride() * count);
+    if (layout->velocityStride() > 0)
+    {
+        glBindBuffer(GL_COPY_READ_BUFFER, velocities[source]);
+        glBindBuffer(GL_COPY_WRITE_BUFFER, velocities[target]);
+        glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, 0, 0, layout->velocityStride() * count);
+    }
+    glBindBuffer(GL_COPY_READ_BUFFER, 0);
+    glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+}
+
+void ParticleRing::fence(int generation)
+{
+    if (fences[generation] != 0)
+    {
+        glDeleteSync(fences[generation]);
+    }
+    fences[generation] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+}
+
+void ParticleRing::wait(int generation)
+{
+    if (fences[generation] == 0)
+    {
+        return;
+    }
+    // the first wait flushes so the fence is guaranteed to come through
+    GLbitfield flags = GL_SYNC_FLUSH_COMMANDS_BIT;
+    while (true)
+    {
+        GLenum result = glClientWaitSync(fences[generation], flags, 1000000);
+        if (result == GL_ALREADY_SIGNALED || result == GL_CONDITION_SATISFIED || result == GL_WAIT_FAILED)
+        {
+            break;
+        }
+        flags = 0;
+    }
+    glDeleteSync(fences[generation]);
+    fences[generation] = 0;
+}
+
+bool ParticleRing::ready(int generation)
+{
+    if (fences[generation] == 0)
+    {
+        return true;
+    }
+    GLenum result = glClientWaitSync(fences[generation], 0, 0);
+    if (result == GL_TIMEOUT_EXPIRED)
+    {
+        return false;
+    }
+    glDeleteSync(fences[generation]);
+    fences[generation] = 0;
+    return true;
+}
+
+void ParticleRing::write(int generation, const std::vector<Particle> &particles)
+{
+    wait(generation);
+    layout->pack(particles);
+    memcpy(mappedBodies[generation], layout->bodies(), layout->bodyStride() * count);
+    if (layout->velocityStride() > 0)
+    {
+        memcpy(mappedVelocities[generation], layout->velocities(), layout->velocityStride() * count);
+    }
+}
+
+void ParticleRing::read(int generation, std::vector<Particle> &particles)
+{
+    wait(generation);
+    particles.resize(count);
+    layout->unpack(mappedBodies[generation], mappedVelocities[generation], particles);
+}
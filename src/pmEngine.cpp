@@ -0,0 +1,308 @@
+#include <pmEngine.h>
+#include <algorithm>
+#include <iostream>
+#include <math.h>
+#include <stdio.h>
+
+// bodies per deposit task
+const int DEPOSIT_CHUNK = 4096;
+
+PmEngine::PmEngine(const EngineConfig &config) : pool(config.threads, config.affinity)
+{
+    meshSize = config.meshSize;
+    if (!isPowerOfTwo(meshSize) || meshSize < 4)
+    {
+        std::cerr << "Mesh size has to be a power of two of at least 4, using 64" << std::endl;
+        meshSize = 64;
+    }
+    isolated = config.boundary != "periodic";
+    if (isolated && config.boundary != "isolated")
+    {
+        std::cerr << "Unknown boundary " << config.boundary << ", using isolated" << std::endl;
+    }
+    paddedSize = isolated ? 2 * meshSize : meshSize;
+
+    char description[128];
+    snprintf(description, sizeof(description), "pm (mesh %d, %s, %d threads)", meshSize, isolated ? "isolated" : "periodic", pool.size());
+    engineName = description;
+}
+
+// Transform of the cloud-in-cell assignment along one axis, sinc^2(pi k / n)
+static float cicWindow(int k, int n)
+{
+    float x = M_PI * std::min(k, n - k) / n;
+    if (x == 0)
+    {
+        return 1;
+    }
+    float sinc = sinf(x) / x;
+    return sinc * sinc;
+}
+
+// Builds the transformed green's function for a cell size of 1, it scales with 1 / cellSize
+void PmEngine::buildKernel()
+{
+    int n = paddedSize;
+    fft.plan(n);
+    kernel.assign((size_t)n * n * n, Complex(0, 0));
+
+    if (isolated)
+    {
+        // 1/r (or its long range part erf(r / 2s) / r) on the padded mesh with minimum image offsets
+        for (int z = 0; z < n; z++)
+        {
+            for (int y = 0; y < n; y++)
+            {
+                for (int x = 0; x < n; x++)
+                {
+                    float dx = std::min(x, n - x);
+                    float dy = std::min(y, n - y);
+                    float dz = std::min(z, n - z);
+                    float r = sqrtf(dx * dx + dy * dy + dz * dz);
+                    float value;
+                    if (splitScale > 0)
+                    {
+                        value = r > 0 ? erff(r / (2 * splitScale)) / r : 1.0f / (splitScale * sqrtf(M_PI));
+                    }
+                    else
+                    {
+                        value = r > 0 ? 1.0f / r : 1.0f;
+                    }
+                    kernel[((size_t)z * n + y) * n + x] = Complex(value, 0);
+                }
+            }
+        }
+        fft.transform(&kernel[0], false, pool);
+
+        // with the long range part band limited it is safe to undo the CIC smoothing
+        // that both the deposit and the interpolation apply
+        if (splitScale > 0)
+        {
+            for (int z = 0; z < n; z++)
+            {
+                for (int y = 0; y < n; y++)
+                {
+                    for (int x = 0; x < n; x++)
+                    {
+                        float window = cicWindow(x, n) * cicWindow(y, n) * cicWindow(z, n);
+                        kernel[((size_t)z * n + y) * n + x] /= window * window;
+                    }
+                }
+            }
+        }
+        return;
+    }
+
+    // 4 pi / k^2 with the eigenvalues of the discrete Laplacian
+    for (int z = 0; z < n; z++)
+    {
+        for (int y = 0; y < n; y++)
+        {
+            for (int x = 0; x < n; x++)
+            {
+                float sx = sinf(M_PI * x / n);
+                float sy = sinf(M_PI * y / n);
+                float sz = sinf(M_PI * z / n);
+                float k2 = 4 * (sx * sx + sy * sy + sz * sz);
+                float value = 0;
+                if (k2 > 0)
+                {
+                    value = 4 * M_PI / k2;
+                    if (splitScale > 0)
+                    {
+                        // undo the CIC smoothing as in the isolated kernel, the short range erfc
+                        // term expects the mesh force to be smoothed by the gaussian alone
+                        float window = cicWindow(x, n) * cicWindow(y, n) * cicWindow(z, n);
+                        value *= expf(-k2 * splitScale * splitScale) / (window * window);
+                    }
+                }
+                kernel[((size_t)z * n + y) * n + x] = Complex(value, 0);
+            }
+        }
+    }
+}
+
+void PmEngine::depositMass(const std::vector<Particle> &particles)
+{
+    int n = meshSize;
+    size_t cells = (size_t)n * n * n;
+    if ((int)threadMass.size() != pool.size())
+    {
+        threadMass.assign(pool.size(), std::vector<float>());
+    }
+    for (size_t t = 0; t < threadMass.size(); t++)
+    {
+        threadMass[t].assign(cells, 0.0f);
+    }
+
+    // every thread deposits into its own mesh so no cell is ever written twice at once
+    int count = particles.size();
+    int chunkCount = (count + DEPOSIT_CHUNK - 1) / DEPOSIT_CHUNK;
+    pool.parallelFor(chunkCount, [&](int chunk, int thread) {
+        float *mass = &threadMass[thread][0];
+        int end = std::min(count, (chunk + 1) * DEPOSIT_CHUNK);
+        for (int i = chunk * DEPOSIT_CHUNK; i < end; i++)
+        {
+            float u = (particles[i].pos.x - origin[0]) / cellSize;
+            float v = (particles[i].pos.y - origin[1]) / cellSize;
+            float w = (particles[i].pos.z - origin[2]) / cellSize;
+            int x = (int)u, y = (int)v, z = (int)w;
+            float fx = u - x, fy = v - y, fz = w - z;
+            float m = particles[i].mass();
+            for (int corner = 0; corner < 8; corner++)
+            {
+                int cx = corner & 1, cy = (corner >> 1) & 1, cz = corner >> 2;
+                float weight = (cx ? fx : 1 - fx) * (cy ? fy : 1 - fy) * (cz ? fz : 1 - fz);
+                mass[((size_t)(z + cz) * n + (y + cy)) * n + (x + cx)] += m * weight;
+            }
+        }
+    });
+
+    // reduce the thread meshes into the (possibly padded) transform grid
+    int p = paddedSize;
+    std::fill(grid.begin(), grid.end(), Complex(0, 0));
+    pool.parallelFor(n, [&](int z, int /*thread*/) {
+        for (int y = 0; y < n; y++)
+        {
+            for (int x = 0; x < n; x++)
+            {
+                size_t cell = ((size_t)z * n + y) * n + x;
+                float sum = 0;
+                for (size_t t = 0; t < threadMass.size(); t++)
+                {
+                    sum += threadMass[t][cell];
+                }
+                grid[((size_t)z * p + y) * p + x] = Complex(sum, 0);
+            }
+        }
+    });
+}
+
+void PmEngine::solvePotential()
+{
+    int p = paddedSize;
+    size_t cells = (size_t)p * p * p;
+    fft.transform(&grid[0], false, pool);
+    for (size_t i = 0; i < cells; i++)
+    {
+        grid[i] *= kernel[i];
+    }
+    fft.transform(&grid[0], true, pool);
+
+    float scale = 1.0f / (cells * cellSize);
+    potential.resize(cells);
+    for (size_t i = 0; i < cells; i++)
+    {
+        potential[i] = grid[i].real() * scale;
+    }
+}
+
+void PmEngine::interpolateField(const std::vector<Particle> &particles)
+{
+    // central differences, indices wrap which is exact for both boundaries
+    int n = meshSize;
+    int p = paddedSize;
+    size_t cells = (size_t)n * n * n;
+    fieldX.resize(cells);
+    fieldY.resize(cells);
+    fieldZ.resize(cells);
+    float inverse2h = 0.5f / cellSize;
+    pool.parallelFor(n, [&](int z, int /*thread*/) {
+        int zm = (z - 1 + p) % p, zp = (z + 1) % p;
+        for (int y = 0; y < n; y++)
+        {
+            int ym = (y - 1 + p) % p, yp = (y + 1) % p;
+            for (int x = 0; x < n; x++)
+            {
+                int xm = (x - 1 + p) % p, xp = (x + 1) % p;
+                size_t cell = ((size_t)z * n + y) * n + x;
+                fieldX[cell] = (potential[((size_t)z * p + y) * p + xp] - potential[((size_t)z * p + y) * p + xm]) * inverse2h;
+                fieldY[cell] = (potential[((size_t)z * p + yp) * p + x] - potential[((size_t)z * p + ym) * p + x]) * inverse2h;
+                fieldZ[cell] = (potential[((size_t)zp * p + y) * p + x] - potential[((size_t)zm * p + y) * p + x]) * inverse2h;
+            }
+        }
+    });
+
+    int count = particles.size();
+    meshX.resize(count);
+    meshY.resize(count);
+    meshZ.resize(count);
+    int chunkCount = (count + DEPOSIT_CHUNK - 1) / DEPOSIT_CHUNK;
+    pool.parallelFor(chunkCount, [&](int chunk, int /*thread*/) {
+        int end = std::min(count, (chunk + 1) * DEPOSIT_CHUNK);
+        for (int i = chunk * DEPOSIT_CHUNK; i < end; i++)
+        {
+            float u = (particles[i].pos.x - origin[0]) / cellSize;
+            float v = (particles[i].pos.y - origin[1]) / cellSize;
+            float w = (particles[i].pos.z - origin[2]) / cellSize;
+            int x = (int)u, y = (int)v, z = (int)w;
+            float fx = u - x, fy = v - y, fz = w - z;
+            float gx = 0, gy = 0, gz = 0;
+            for (int corner = 0; corner < 8; corner++)
+            {
+                int cx = corner & 1, cy = (corner >> 1) & 1, cz = corner >> 2;
+                float weight = (cx ? fx : 1 - fx) * (cy ? fy : 1 - fy) * (cz ? fz : 1 - fz);
+                size_t cell = ((size_t)(z + cz) * n + (y + cy)) * n + (x + cx);
+                gx += weight * fieldX[cell];
+                gy += weight * fieldY[cell];
+                gz += weight * fieldZ[cell];
+            }
+            meshX[i] = gx;
+            meshY[i] = gy;
+            meshZ[i] = gz;
+        }
+    });
+}
+
+void PmEngine::computeMeshField(const std::vector<Particle> &particles)
+{
+    if (kernel.empty())
+    {
+        buildKernel();
+        grid.resize(kernel.size());
+    }
+
+    // fit the mesh around the bodies with a spare cell on every side for the deposit
+    float minimum[3] = {0, 0, 0};
+    float maximum[3] = {0, 0, 0};
+    if (!particles.empty())
+    {
+        for (int axis = 0; axis < 3; axis++)
+        {
+            minimum[axis] = maximum[axis] = particles[0].pos[axis];
+        }
+    }
+    for (size_t i = 0; i < particles.size(); i++)
+    {
+        for (int axis = 0; axis < 3; axis++)
+        {
+            minimum[axis] = std::min(minimum[axis], particles[i].pos[axis]);
+            maximum[axis] = std::max(maximum[axis], particles[i].pos[axis]);
+        }
+    }
+    float extent = 0;
+    for (int axis = 0; axis < 3; axis++)
+    {
+        extent = std::max(extent, maximum[axis] - minimum[axis]);
+    }
+    cellSize = std::max(extent, 1e-6f) / (meshSize - 3);
+    for (int axis = 0; axis < 3; axis++)
+    {
+        origin[axis] = 0.5f * (minimum[axis] + maximum[axis]) - 0.5f * (meshSize - 1) * cellSize;
+    }
+
+    depositMass(particles);
+    solvePotential();
+    interpolateField(particles);
+}
+
+void PmEngine::computeAccelerations(const std::vector<Particle> &particles, std::vector<cy::Vec3f> &acc)
+{
+    computeMeshField(particles);
+    for (size_t i = 0; i < particles.size(); i++)
+    {
+        float gm = GRAVITY * particles[i].mass();
+        acc[i] = cy::Vec3f(gm * meshX[i], gm * meshY[i], gm * meshZ[i]);
+    }
+    interactions += particles.size();
+}
@@ -0,0 +1,198 @@
+#include <reorder.h>
+#include <algorithm>
+#include <iostream>
+
+const int KEY_BITS = 21;
+const int RADIX_BITS = 8;
+const int RADIX_BUCKETS = 1 << RADIX_BITS;
+
+// bodies per key task
+const int KEY_CHUNK = 8192;
+
+// Spreads the low 21 bits of v so there are two zero bits between each of them
+static uint64_t spreadBits(uint32_t v)
+{
+    uint64_t x = v & 0x1fffff;
+    x = (x | x << 32) & 0x1f00000000ffffull;
+    x = (x | x << 16) & 0x1f0000ff0000ffull;
+    x = (x | x << 8) & 0x100f00f00f00f00full;
+    x = (x | x << 4) & 0x10c30c30c30c30c3ull;
+    x = (x | x << 2) & 0x1249249249249249ull;
+    return x;
+}
+
+uint64_t mortonKey(uint32_t x, uint32_t y, uint32_t z)
+{
+    return spreadBits(x) << 2 | spreadBits(y) << 1 | spreadBits(z);
+}
+
+// Skilling's axes-to-transpose transform, the interleaved result is the hilbert index
+uint64_t hilbertKey(uint32_t x, uint32_t y, uint32_t z)
+{
+    uint32_t axes[3] = {x, y, z};
+    uint32_t top = 1u << (KEY_BITS - 1);
+
+    // inverse undo excess work
+    for (uint32_t q = top; q > 1; q >>= 1)
+    {
+        uint32_t p = q - 1;
+        for (int i = 0; i < 3; i++)
+        {
+            if (axes[i] & q)
+            {
+                axes[0] ^= p;
+            }
+            else
+            {
+                uint32_t t = (axes[0] ^ axes[i]) & p;
+                axes[0] ^= t;
+                axes[i] ^= t;
+            }
+        }
+    }
+
+    // gray encode
+    for (int i = 1; i < 3; i++)
+    {
+        axes[i] ^= axes[i - 1];
+    }
+    uint32_t t = 0;
+    for (uint32_t q = top; q > 1; q >>= 1)
+    {
+        if (axes[2] & q)
+        {
+            t ^= q - 1;
+        }
+    }
+    for (int i = 0; i < 3; i++)
+    {
+        axes[i] ^= t;
+    }
+
+    return mortonKey(axes[0], axes[1], axes[2]);
+}
+
+void radixSort(std::vector<uint64_t> &keys, std::vector<int> &values, ThreadPool &pool)
+{
+    int count = keys.size();
+    int chunks = std::max(1, std::min(pool.size(), count / KEY_CHUNK));
+    int chunkSize = (count + chunks - 1) / chunks;
+    std::vector<uint64_t> keyScratch(count);
+    std::vector<int> valueScratch(count);
+    std::vector<int> histograms(chunks * RADIX_BUCKETS);
+
+    for (int shift = 0; shift < 3 * KEY_BITS; shift += RADIX_BITS)
+    {
+        std::fill(histograms.begin(), histograms.end(), 0);
+        pool.parallelFor(chunks, [&](int chunk, int /*thread*/) {
+            int *histogram = &histograms[chunk * RADIX_BUCKETS];
+            int end = std::min(count, (chunk + 1) * chunkSize);
+            for (int i = chunk * chunkSize; i < end; i++)
+            {
+                histogram[(keys[i] >> shift) & (RADIX_BUCKETS - 1)]++;
+            }
+        });
+
+        // digit-major prefix sum keeps the sort stable across chunks
+        int offset = 0;
+        bool allSame = false;
+        for (int digit = 0; digit < RADIX_BUCKETS; digit++)
+        {
+            int digitTotal = 0;
+            for (int chunk = 0; chunk < chunks; chunk++)
+            {
+                int n = histograms[chunk * RADIX_BUCKETS + digit];
+                histograms[chunk * RADIX_BUCKETS + digit] = offset;
+                offset += n;
+                digitTotal += n;
+            }
+            allSame = allSame || digitTotal == count;
+        }
+        if (allSame)
+        {
+            continue;
+        }
+
+        pool.parallelFor(chunks, [&](int chunk, int /*thread*/) {
+            int *next = &histograms[chunk * RADIX_BUCKETS];
+            int end = std::min(count, (chunk + 1) * chunkSize);
+            for (int i = chunk * chunkSize; i < end; i++)
+            {
+                int slot = next[(keys[i] >> shift) & (RADIX_BUCKETS - 1)]++;
+                keyScratch[slot] = keys[i];
+                valueScratch[slot] = values[i];
+            }
+        });
+        keys.swap(keyScratch);
+        values.swap(valueScratch);
+    }
+}
+
+SpatialReorder::SpatialReorder(const std::string &curve, int threads) : pool(threads, "none")
+{
+    hilbert = curve == "hilbert";
+    if (!hilbert && curve != "morton")
+    {
+        std::cerr << "Unknown curve " << curve << ", using morton" << std::endl;
+    }
+}
+
+void SpatialReorder::apply(std::vector<Particle> &particles, std::vector<int> &bodyIds)
+{
+    int count = particles.size();
+    if (count == 0)
+    {
+        return;
+    }
+
+    float minimum[3], maximum[3];
+    for (int axis = 0; axis < 3; axis++)
+    {
+        minimum[axis] = maximum[axis] = particles[0].pos[axis];
+    }
+    for (int i = 0; i < count; i++)
+    {
+        for (int axis = 0; axis < 3; axis++)
+        {
+            minimum[axis] = std::min(minimum[axis], particles[i].pos[axis]);
+            maximum[axis] = std::max(maximum[axis], particles[i].pos[axis]);
+        }
+    }
+    // one scale for every axis so the curve cells stay cubes
+    float extent = 0;
+    for (int axis = 0; axis < 3; axis++)
+    {
+        extent = std::max(extent, maximum[axis] - minimum[axis]);
+    }
+    float scale = extent > 0 ? ((1u << KEY_BITS) - 1) / extent : 0;
+
+    keys.resize(count);
+    permutation.resize(count);
+    int chunkCount = (count + KEY_CHUNK - 1) / KEY_CHUNK;
+    pool.parallelFor(chunkCount, [&](int chunk, int /*thread*/) {
+        int end = std::min(count, (chunk + 1) * KEY_CHUNK);
+        for (int i = chunk * KEY_CHUNK; i < end; i++)
+        {
+            uint32_t x = (particles[i].pos.x - minimum[0]) * scale;
+            uint32_t y = (particles[i].pos.y - minimum[1]) * scale;
+            uint32_t z = (particles[i].pos.z - minimum[2]) * scale;
+            keys[i] = hilbert ? hilbertKey(x, y, z) : mortonKey(x, y, z);
+            permutation[i] = i;
+        }
+    });
+
+    radixSort(keys, permutation, pool);
+
+    scratch.resize(count);
+    idScratch.resize(count);
+    pool.parallelFor(chunkCount, [&](int chunk, int /*thread*/) {
+        int end = std::min(count, (chunk + 1) * KEY_CHUNK);
+        for (int i = chunk * KEY_CHUNK; i < end; i++)
+        {
+            scratch[i] = particles[permutation[i]];
+            idScratch[i] = bodyIds[permutation[i]];
+        }
+    });
+    particles.swap(scratch);
+    bodyIds.swap(idScratch);
+}
@@ -0,0 +1,378 @@
+#include <simdEngine.h>
+#include <immintrin.h>
+#include <iostream>
+#include <math.h>
+
+ParticleArrays::~ParticleArrays()
+{
+    _mm_free(x);
+    _mm_free(y);
+    _mm_free(z);
+    _mm_free(mass);
+}
+
+void ParticleArrays::load(const std::vector<Particle> &particles)
+{
+    count = particles.size();
+    paddedCount = (count + SIMD_WIDTH - 1) / SIMD_WIDTH * SIMD_WIDTH;
+    if (paddedCount > capacity)
+    {
+        _mm_free(x);
+        _mm_free(y);
+        _mm_free(z);
+        _mm_free(mass);
+        capacity = paddedCount;
+        x = (float *)_mm_malloc(sizeof(float) * capacity, 64);
+        y = (float *)_mm_malloc(sizeof(float) * capacity, 64);
+        z = (float *)_mm_malloc(sizeof(float) * capacity, 64);
+        mass = (float *)_mm_malloc(sizeof(float) * capacity, 64);
+    }
+
+    for (int i = 0; i < count; i++)
+    {
+        x[i] = particles[i].pos.x;
+        y[i] = particles[i].pos.y;
+        z[i] = particles[i].pos.z;
+        mass[i] = particles[i].mass();
+    }
+    // padding bodies have no mass so they never pull on anything
+    for (int i = count; i < paddedCount; i++)
+    {
+        x[i] = 0;
+        y[i] = 0;
+        z[i] = 0;
+        mass[i] = 0;
+    }
+}
+
+// 1/(max(r2, 0.01) * r) without a divide: invR^3 when unclamped, invR/0.01 inside the clamp.
+// Coincident bodies (including i == j) get 0 instead of the shader's NaN from normalize().
+static void scalarKernel(const ParticleArrays &bodies, int iBegin, int iEnd, int jBegin, int jEnd, float *ax, float *ay, float *az)
+{
+    for (int i = iBegin; i < iEnd; i++)
+    {
+        float xi = bodies.x[i];
+        float yi = bodies.y[i];
+        float zi = bodies.z[i];
+        float sumX = 0;
+        float sumY = 0;
+        float sumZ = 0;
+        for (int j = jBegin; j < jEnd; j++)
+        {
+            float dx = bodies.x[j] - xi;
+            float dy = bodies.y[j] - yi;
+            float dz = bodies.z[j] - zi;
+            float dist2 = dx * dx + dy * dy + dz * dz;
+            float invR = dist2 > 0 ? 1.0f / sqrtf(dist2) : 0;
+            float scale = dist2 < MIN_DISTANCE_SQUARED ? invR * (1.0f / MIN_DISTANCE_SQUARED) : invR * invR * invR;
+            float s = bodies.mass[j] * scale;
+            sumX += s * dx;
+            sumY += s * dy;
+            sumZ += s * dz;
+        }
+        ax[i] += sumX;
+        ay[i] += sumY;
+        az[i] += sumZ;
+    }
+}
+
+static void scalarSymmetricKernel(const ParticleArrays &bodies, int iBegin, int iEnd, int jBegin, int jEnd, bool diagonal, float *fx, float *fy, float *fz)
+{
+    for (int i = iBegin; i < iEnd; i++)
+    {
+        float xi = bodies.x[i];
+        float yi = bodies.y[i];
+        float zi = bodies.z[i];
+        float mi = bodies.mass[i];
+        float sumX = 0;
+        float sumY = 0;
+        float sumZ = 0;
+        for (int j = diagonal ? i + 1 : jBegin; j < jEnd; j++)
+        {
+            float dx = bodies.x[j] - xi;
+            float dy = bodies.y[j] - yi;
+            float dz = bodies.z[j] - zi;
+            float dist2 = dx * dx + dy * dy + dz * dz;
+            float invR = dist2 > 0 ? 1.0f / sqrtf(dist2) : 0;
+            float scale = dist2 < MIN_DISTANCE_SQUARED ? invR * (1.0f / MIN_DISTANCE_SQUARED) : invR * invR * invR;
+            float s = mi * bodies.mass[j] * scale;
+            sumX += s * dx;
+            sumY += s * dy;
+            sumZ += s * dz;
+            fx[j] -= s * dx;
+            fy[j] -= s * dy;
+            fz[j] -= s * dz;
+        }
+        fx[i] += sumX;
+        fy[i] += sumY;
+        fz[i] += sumZ;
+    }
+}
+
+__attribute__((target("avx2,fma"))) static float horizontalSum(__m256 v)
+{
+    __m128 sum = _mm_add_ps(_mm256_castps256_ps128(v), _mm256_extractf128_ps(v, 1));
+    sum = _mm_add_ps(sum, _mm_movehl_ps(sum, sum));
+    sum = _mm_add_ss(sum, _mm_shuffle_ps(sum, sum, 1));
+    return _mm_cvtss_f32(sum);
+}
+
+__attribute__((target("avx2,fma"))) static void avx2Kernel(const ParticleArrays &bodies, int iBegin, int iEnd, int jBegin, int jEnd, float *ax, float *ay, float *az)
+{
+    const __m256 zero = _mm256_setzero_ps();
+    const __m256 half = _mm256_set1_ps(0.5f);
+    const __m256 threeHalves = _mm256_set1_ps(1.5f);
+    const __m256 minDist2 = _mm256_set1_ps(MIN_DISTANCE_SQUARED);
+    const __m256 invMinDist2 = _mm256_set1_ps(1.0f / MIN_DISTANCE_SQUARED);
+
+    for (int i = iBegin; i < iEnd; i++)
+    {
+        __m256 xi = _mm256_set1_ps(bodies.x[i]);
+        __m256 yi = _mm256_set1_ps(bodies.y[i]);
+        __m256 zi = _mm256_set1_ps(bodies.z[i]);
+        __m256 sumX = zero;
+        __m256 sumY = zero;
+        __m256 sumZ = zero;
+        for (int j = jBegin; j < jEnd; j += 8)
+        {
+            __m256 dx = _mm256_sub_ps(_mm256_load_ps(bodies.x + j), xi);
+            __m256 dy = _mm256_sub_ps(_mm256_load_ps(bodies.y + j), yi);
+            __m256 dz = _mm256_sub_ps(_mm256_load_ps(bodies.z + j), zi);
+            __m256 dist2 = _mm256_fmadd_ps(dz, dz, _mm256_fmadd_ps(dy, dy, _mm256_mul_ps(dx, dx)));
+
+            // rsqrt estimate plus one Newton step: y * (1.5 - 0.5 * d2 * y * y)
+            __m256 invR = _mm256_rsqrt_ps(dist2);
+            invR = _mm256_mul_ps(invR, _mm256_fnmadd_ps(_mm256_mul_ps(half, dist2), _mm256_mul_ps(invR, invR), threeHalves));
+            invR = _mm256_and_ps(invR, _mm256_cmp_ps(dist2, zero, _CMP_GT_OQ));
+
+            __m256 invR3 = _mm256_mul_ps(invR, _mm256_mul_ps(invR, invR));
+            __m256 clamped = _mm256_mul_ps(invR, invMinDist2);
+            __m256 scale = _mm256_blendv_ps(invR3, clamped, _mm256_cmp_ps(dist2, minDist2, _CMP_LT_OQ));
+            __m256 s = _mm256_mul_ps(_mm256_load_ps(bodies.mass + j), scale);
+
+            sumX = _mm256_fmadd_ps(s, dx, sumX);
+            sumY = _mm256_fmadd_ps(s, dy, sumY);
+            sumZ = _mm256_fmadd_ps(s, dz, sumZ);
+        }
+        ax[i] += horizontalSum(sumX);
+        ay[i] += horizontalSum(sumY);
+        az[i] += horizontalSum(sumZ);
+    }
+}
+
+__attribute__((target("avx2,fma"))) static void avx2SymmetricKernel(const ParticleArrays &bodies, int iBegin, int iEnd, int jBegin, int jEnd, bool diagonal, float *fx, float *fy, float *fz)
+{
+    const __m256 zero = _mm256_setzero_ps();
+    const __m256 half = _mm256_set1_ps(0.5f);
+    const __m256 threeHalves = _mm256_set1_ps(1.5f);
+    const __m256 minDist2 = _mm256_set1_ps(MIN_DISTANCE_SQUARED);
+    const __m256 invMinDist2 = _mm256_set1_ps(1.0f / MIN_DISTANCE_SQUARED);
+    const __m256i lanes = _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7);
+
+    for (int i = iBegin; i < iEnd; i++)
+    {
+        __m256 xi = _mm256_set1_ps(bodies.x[i]);
+        __m256 yi = _mm256_set1_ps(bodies.y[i]);
+        __m256 zi = _mm256_set1_ps(bodies.z[i]);
+        __m256 mi = _mm256_set1_ps(bodies.mass[i]);
+        __m256i iIndex = _mm256_set1_epi32(i);
+        __m256 sumX = zero;
+        __m256 sumY = zero;
+        __m256 sumZ = zero;
+        // on the diagonal start at the block holding i + 1 and mask off j <= i
+        int start = diagonal ? (i + 1) / 8 * 8 : jBegin;
+        for (int j = start; j < jEnd; j += 8)
+        {
+            __m256 dx = _mm256_sub_ps(_mm256_load_ps(bodies.x + j), xi);
+            __m256 dy = _mm256_sub_ps(_mm256_load_ps(bodies.y + j), yi);
+            __m256 dz = _mm256_sub_ps(_mm256_load_ps(bodies.z + j), zi);
+            __m256 dist2 = _mm256_fmadd_ps(dz, dz, _mm256_fmadd_ps(dy, dy, _mm256_mul_ps(dx, dx)));
+
+            __m256 invR = _mm256_rsqrt_ps(dist2);
+            invR = _mm256_mul_ps(invR, _mm256_fnmadd_ps(_mm256_mul_ps(half, dist2), _mm256_mul_ps(invR, invR), threeHalves));
+            __m256 valid = _mm256_cmp_ps(dist2, zero, _CMP_GT_OQ);
+            if (diagonal)
+            {
+                __m256i jIndex = _mm256_add_epi32(_mm256_set1_epi32(j), lanes);
+                valid = _mm256_and_ps(valid, _mm256_castsi256_ps(_mm256_cmpgt_epi32(jIndex, iIndex)));
+            }
+            invR = _mm256_and_ps(invR, valid);
+
+            __m256 invR3 = _mm256_mul_ps(invR, _mm256_mul_ps(invR, invR));
+            __m256 clamped = _mm256_mul_ps(invR, invMinDist2);
+            __m256 scale = _mm256_blendv_ps(invR3, clamped, _mm256_cmp_ps(dist2, minDist2, _CMP_LT_OQ));
+            __m256 s = _mm256_mul_ps(_mm256_mul_ps(mi, _mm256_load_ps(bodies.mass + j)), scale);
+
+            __m256 forceX = _mm256_mul_ps(s, dx);
+            __m256 forceY = _mm256_mul_ps(s, dy);
+            __m256 forceZ = _mm256_mul_ps(s, dz);
+            sumX = _mm256_add_ps(sumX, forceX);
+            sumY = _mm256_add_ps(sumY, forceY);
+            sumZ = _mm256_add_ps(sumZ, forceZ);
+            _mm256_storeu_ps(fx + j, _mm256_sub_ps(_mm256_loadu_ps(fx + j), forceX));
+            _mm256_storeu_ps(fy + j, _mm256_sub_ps(_mm256_loadu_ps(fy + j), forceY));
+            _mm256_storeu_ps(fz + j, _mm256_sub_ps(_mm256_loadu_ps(fz + j), forceZ));
+        }
+        fx[i] += horizontalSum(sumX);
+        fy[i] += horizontalSum(sumY);
+        fz[i] += horizontalSum(sumZ);
+    }
+}
+
+__attribute__((target("avx512f"))) static void avx512Kernel(const ParticleArrays &bodies, int iBegin, int iEnd, int jBegin, int jEnd, float *ax, float *ay, float *az)
+{
+    const __m512 zero = _mm512_setzero_ps();
+    const __m512 half = _mm512_set1_ps(0.5f);
+    const __m512 threeHalves = _mm512_set1_ps(1.5f);
+    const __m512 minDist2 = _mm512_set1_ps(MIN_DISTANCE_SQUARED);
+    const __m512 invMinDist2 = _mm512_set1_ps(1.0f / MIN_DISTANCE_SQUARED);
+
+    for (int i = iBegin; i < iEnd; i++)
+    {
+        __m512 xi = _mm512_set1_ps(bodies.x[i]);
+        __m512 yi = _mm512_set1_ps(bodies.y[i]);
+        __m512 zi = _mm512_set1_ps(bodies.z[i]);
+        __m512 sumX = zero;
+        __m512 sumY = zero;
+        __m512 sumZ = zero;
+        for (int j = jBegin; j < jEnd; j += 16)
+        {
+            __m512 dx = _mm512_sub_ps(_mm512_load_ps(bodies.x + j), xi);
+            __m512 dy = _mm512_sub_ps(_mm512_load_ps(bodies.y + j), yi);
+            __m512 dz = _mm512_sub_ps(_mm512_load_ps(bodies.z + j), zi);
+            __m512 dist2 = _mm512_fmadd_ps(dz, dz, _mm512_fmadd_ps(dy, dy, _mm512_mul_ps(dx, dx)));
+
+            // 14 bit estimate plus one Newton step
+            __mmask16 nonZero = _mm512_cmp_ps_mask(dist2, zero, _CMP_GT_OQ);
+            __m512 invR = _mm512_maskz_rsqrt14_ps(nonZero, dist2);
+            invR = _mm512_mul_ps(invR, _mm512_fnmadd_ps(_mm512_mul_ps(half, dist2), _mm512_mul_ps(invR, invR), threeHalves));
+
+            __m512 scale = _mm512_mul_ps(invR, _mm512_mul_ps(invR, invR));
+            scale = _mm512_mask_mul_ps(scale, _mm512_cmp_ps_mask(dist2, minDist2, _CMP_LT_OQ), invR, invMinDist2);
+            __m512 s = _mm512_mul_ps(_mm512_load_ps(bodies.mass + j), scale);
+
+            sumX = _mm512_fmadd_ps(s, dx, sumX);
+            sumY = _mm512_fmadd_ps(s, dy, sumY);
+            sumZ = _mm512_fmadd_ps(s, dz, sumZ);
+        }
+        ax[i] += _mm512_reduce_add_ps(sumX);
+        ay[i] += _mm512_reduce_add_ps(sumY);
+        az[i] += _mm512_reduce_add_ps(sumZ);
+    }
+}
+
+__attribute__((target("avx512f"))) static void avx512SymmetricKernel(const ParticleArrays &bodies, int iBegin, int iEnd, int jBegin, int jEnd, bool diagonal, float *fx, float *fy, float *fz)
+{
+    const __m512 zero = _mm512_setzero_ps();
+    const __m512 half = _mm512_set1_ps(0.5f);
+    const __m512 threeHalves = _mm512_set1_ps(1.5f);
+    const __m512 minDist2 = _mm512_set1_ps(MIN_DISTANCE_SQUARED);
+    const __m512 invMinDist2 = _mm512_set1_ps(1.0f / MIN_DISTANCE_SQUARED);
+    const __m512i lanes = _mm512_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15);
+
+    for (int i = iBegin; i < iEnd; i++)
+    {
+        __m512 xi = _mm512_set1_ps(bodies.x[i]);
+        __m512 yi = _mm512_set1_ps(bodies.y[i]);
+        __m512 zi = _mm512_set1_ps(bodies.z[i]);
+        __m512 mi = _mm512_set1_ps(bodies.mass[i]);
+        __m512i iIndex = _mm512_set1_epi32(i);
+        __m512 sumX = zero;
+        __m512 sumY = zero;
+        __m512 sumZ = zero;
+        int start = diagonal ? (i + 1) / 16 * 16 : jBegin;
+        for (int j = start; j < jEnd; j += 16)
+        {
+            __m512 dx = _mm512_sub_ps(_mm512_load_ps(bodies.x + j), xi);
+            __m512 dy = _mm512_sub_ps(_mm512_load_ps(bodies.y + j), yi);
+            __m512 dz = _mm512_sub_ps(_mm512_load_ps(bodies.z + j), zi);
+            __m512 dist2 = _mm512_fmadd_ps(dz, dz, _mm512_fmadd_ps(dy, dy, _mm512_mul_ps(dx, dx)));
+
+            __mmask16 valid = _mm512_cmp_ps_mask(dist2, zero, _CMP_GT_OQ);
+            if (diagonal)
+            {
+                valid &= _mm512_cmpgt_epi32_mask(_mm512_add_epi32(_mm512_set1_epi32(j), lanes), iIndex);
+            }
+            __m512 invR = _mm512_maskz_rsqrt14_ps(valid, dist2);
+            invR = _mm512_mul_ps(invR, _mm512_fnmadd_ps(_mm512_mul_ps(half, dist2), _mm512_mul_ps(invR, invR), threeHalves));
+
+            __m512 scale = _mm512_mul_ps(invR, _mm512_mul_ps(invR, invR));
+            scale = _mm512_mask_mul_ps(scale, _mm512_cmp_ps_mask(dist2, minDist2, _CMP_LT_OQ), invR, invMinDist2);
+            __m512 s = _mm512_mul_ps(_mm512_mul_ps(mi, _mm512_load_ps(bodies.mass + j)), scale);
+
+            __m512 forceX = _mm512_mul_ps(s, dx);
+            __m512 forceY = _mm512_mul_ps(s, dy);
+            __m512 forceZ = _mm512_mul_ps(s, dz);
+            sumX = _mm512_add_ps(sumX, forceX);
+            sumY = _mm512_add_ps(sumY, forceY);
+            sumZ = _mm512_add_ps(sumZ, forceZ);
+            _mm512_storeu_ps(fx + j, _mm512_sub_ps(_mm512_loadu_ps(fx + j), forceX));
+            _mm512_storeu_ps(fy + j, _mm512_sub_ps(_mm512_loadu_ps(fy + j), forceY));
+            _mm512_storeu_ps(fz + j, _mm512_sub_ps(_mm512_loadu_ps(fz + j), forceZ));
+        }
+        fx[i] += _mm512_reduce_add_ps(sumX);
+        fy[i] += _mm512_reduce_add_ps(sumY);
+        fz[i] += _mm512_reduce_add_ps(sumZ);
+    }
+}
+
+PairKernelInfo selectPairKernel(const std::string &simd)
+{
+    bool avx512 = __builtin_cpu_supports("avx512f");
+    bool avx2 = __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma");
+
+    if ((simd == "auto" || simd == "avx512") && avx512)
+    {
+        return {"avx512", avx512Kernel, avx512SymmetricKernel};
+    }
+    if ((simd == "auto" || simd == "avx2") && avx2)
+    {
+        return {"avx2", avx2Kernel, avx2SymmetricKernel};
+    }
+    if (simd != "auto" && simd != "scalar")
+    {
+        std::cerr << "SIMD level " << simd << " is not supported here, using scalar" << std::endl;
+    }
+    return {"scalar", scalarKernel, scalarSymmetricKernel};
+}
+
+SimdEngine::SimdEngine(const EngineConfig &config)
+{
+    kernel = selectPairKernel(config.simd);
+    engineName = std::string("simd-") + kernel.name;
+}
+
+void SimdEngine::computeAccelerations(const std::vector<Particle> &particles, std::vector<cy::Vec3f> &acc)
+{
+    bodies.load(particles);
+    ax.assign(bodies.paddedCount, 0);
+    ay.assign(bodies.paddedCount, 0);
+    az.assign(bodies.paddedCount, 0);
+
+    kernel.kernel(bodies, 0, bodies.count, 0, bodies.paddedCount, &ax[0], &ay[0], &az[0]);
+
+    for (int i = 0; i < bodies.count; i++)
+    {
+        float gm = GRAVITY * bodies.mass[i];
+        acc[i] = cy::Vec3f(gm * ax[i], gm * ay[i], gm * az[i]);
+    }
+    interactions += (long long)bodies.count * (bodies.count - 1);
+}
+
+void SimdEngine::computeActiveAccelerations(const std::vector<Particle> &particles, const std::vector<int> &active, std::vector<cy::Vec3f> &acc)
+{
+    bodies.load(particles);
+    ax.resize(bodies.paddedCount);
+    ay.resize(bodies.paddedCount);
+    az.resize(bodies.paddedCount);
+
+    for (size_t a = 0; a < active.size(); a++)
+    {
+        int i = active[a];
+        ax[i] = ay[i] = az[i] = 0;
+        kernel.kernel(bodies, i, i + 1, 0, bodies.paddedCount, &ax[0], &ay[0], &az[0]);
+        float gm = GRAVITY * bodies.mass[i];
+        acc[i] = cy::Vec3f(gm * ax[i], gm * ay[i], gm * az[i]);
+    }
+    interactions += (long long)active.size() * (bodies.count - 1);
+}
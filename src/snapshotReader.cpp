@@ -0,0 +1,201 @@
+#include <snapshotReader.h>
+#include <algorithm>
+#include <string.h>
+
+static const GLbitfield STAGING_FLAGS = GL_MAP_READ_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+
+static GLuint createStagingBuffer(size_t bytes, void *&mapped)
+{
+    GLuint buffer;
+    glGenBuffers(1, &buffer);
+    glBindBuffer(GL_COPY_WRITE_BUFFER, buffer);
+    // client storage hints the driver to keep it in host memory, where the reads happen
+    glBufferStorage(GL_COPY_WRITE_BUFFER, bytes, nullptr, STAGING_FLAGS | GL_CLIENT_STORAGE_BIT);
+    mapped = glMapBufferRange(GL_COPY_WRITE_BUFFER, 0, bytes, STAGING_FLAGS);
+    glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+    return buffer;
+}
+
+static void copyBuffer(GLuint source, GLuint target, size_t bytes)
+{
+    glBindBuffer(GL_COPY_READ_BUFFER, source);
+    glBindBuffer(GL_COPY_WRITE_BUFFER, target);
+    glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, 0, 0, bytes);
+    glBindBuffer(GL_COPY_READ_BUFFER, 0);
+    glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+}
+
+SnapshotReader::SnapshotReader(ParticleLayout *layout, int count, const std::function<void(const Snapshot &)> &consumer)
+{
+    this->layout = layout;
+    this->count = count;
+    this->consumer = consumer;
+    for (int s = 0; s < STAGING_SLOTS; s++)
+    {
+        slots[s].bodies = createStagingBuffer(layout->bodyStride() * count, slots[s].mappedBodies);
+        if (layout->velocityStride() > 0)
+        {
+            slots[s].velocities = createStagingBuffer(layout->velocityStride() * count, slots[s].mappedVelocities);
+        }
+    }
+    worker = std::thread(&SnapshotReader::consumerLoop, this);
+}
+
+SnapshotReader::~SnapshotReader()
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+    }
+    wake.notify_one();
+    worker.join();
+}
+
+bool SnapshotReader::request(GLuint bodyBuffer, GLuint velocityBuffer, int step, long long frame, const std::vector<int> &bodyIds,
+                             const std::shared_ptr<Checkpoint> &checkpoint)
+{
+    if (inFlight == STAGING_SLOTS)
+    {
+        dropped++;
+        return false;
+    }
+    Staging &slot = slots[(oldest + inFlight) % STAGING_SLOTS];
+    inFlight++;
+
+    copyBuffer(bodyBuffer, slot.bodies, layout->bodyStride() * count);
+    if (slot.velocities != 0)
+    {
+        copyBuffer(velocityBuffer, slot.velocities, layout->velocityStride() * count);
+    }
+    slot.fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+    slot.step = step;
+    slot.frame = frame;
+    slot.bodyIds = bodyIds;
+    slot.checkpoint = checkpoint;
+    return true;
+}
+
+void SnapshotReader::discard()
+{
+    // copies still running on the gpu only land in slots nobody reads until they are requested again
+    for (; inFlight > 0; inFlight--)
+    {
+        Staging &slot = slots[oldest];
+        glDeleteSync(slot.fence);
+        slot.fence = 0;
+        slot.bodyIds.clear();
+        slot.checkpoint.reset();
+        oldest = (oldest + 1) % STAGING_SLOTS;
+    }
+    std::lock_guard<std::mutex> lock(mutex);
+    pending.clear();
+}
+
+void SnapshotReader::poll(long long frame)
+{
+    // fences signal in order, so the oldest copy is always the first to finish
+    while (inFlight > 0)
+    {
+        Staging &slot = slots[oldest];
+        // flushing without waiting makes sure the fence gets to the gpu at all
+        GLenum result = glClientWaitSync(slot.fence, GL_SYNC_FLUSH_COMMANDS_BIT, 0);
+        if (result == GL_TIMEOUT_EXPIRED)
+        {
+            return;
+        }
+        glDeleteSync(slot.fence);
+        slot.fence = 0;
+        oldest = (oldest + 1) % STAGING_SLOTS;
+        inFlight--;
+        if (result == GL_WAIT_FAILED || backlogFull())
+        {
+            dropped++;
+            continue;
+        }
+
+        // one memcpy frees the slot, unpacking is left to the consumer thread
+        Pending snapshot;
+        snapshot.step = slot.step;
+        snapshot.latency = frame - slot.frame;
+        const unsigned char *bodies = (const unsigned char *)slot.mappedBodies;
+        snapshot.bodies.assign(bodies, bodies + layout->bodyStride() * count);
+        if (slot.mappedVelocities != nullptr)
+        {
+            const unsigned char *velocities = (const unsigned char *)slot.mappedVelocities;
+            snapshot.velocities.assign(velocities, velocities + layout->velocityStride() * count);
+        }
+        snapshot.bodyIds.swap(slot.bodyIds);
+        snapshot.checkpoint.swap(slot.checkpoint);
+
+        delivered++;
+        totalLatency += snapshot.latency;
+        maxLatency = std::max(maxLatency, snapshot.latency);
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            pending.push_back(std::move(snapshot));
+        }
+        wake.notify_one();
+    }
+}
+
+void SnapshotReader::deliver(int step, const std::vector<Particle> &particles, const std::vector<int> &bodyIds)
+{
+    if (backlogFull())
+    {
+        dropped++;
+        return;
+    }
+    Pending snapshot;
+    snapshot.step = step;
+    snapshot.latency = 0;
+    snapshot.particles = particles;
+    snapshot.bodyIds = bodyIds;
+    delivered++;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        pending.push_back(std::move(snapshot));
+    }
+    wake.notify_one();
+}
+
+bool SnapshotReader::backlogFull()
+{
+    // only the consumer takes snapshots out, so the answer can't turn from no to yes behind the caller
+    std::lock_guard<std::mutex> lock(mutex);
+    return pending.size() >= (size_t)STAGING_SLOTS;
+}
+
+void SnapshotReader::consumerLoop()
+{
+    Snapshot snapshot;
+    while (true)
+    {
+        Pending next;
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            wake.wait(lock, [this] { return stopping || !pending.empty(); });
+            if (pending.empty())
+            {
+                return;
+            }
+            next = std::move(pending.front());
+            pending.pop_front();
+        }
+
+        snapshot.step = next.step;
+        snapshot.latency = next.latency;
+        if (next.bodies.empty())
+        {
+            snapshot.particles.swap(next.particles);
+        }
+        else
+        {
+            snapshot.particles.resize(count);
+            layout->unpack(next.bodies.data(), next.velocities.data(), snapshot.particles);
+        }
+        snapshot.bodyIds.swap(next.bodyIds);
+        snapshot.checkpoint.swap(next.checkpoint);
+        consumer(snapshot);
+        snapshot.checkpoint.reset();
+    }
+}
@@ -0,0 +1,128 @@
+#include <threadPool.h>
+#include <algorithm>
+#include <iostream>
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+// Pins the calling thread to one cpu, failures only cost performance so they are just reported
+static void pinThread(int cpu)
+{
+#ifdef _WIN32
+    if (SetThreadAffinityMask(GetCurrentThread(), DWORD_PTR(1) << (cpu % (sizeof(DWORD_PTR) * 8))) == 0)
+    {
+        std::cerr << "Could not pin thread to cpu " << cpu << std::endl;
+    }
+#else
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(cpu, &set);
+    if (pthread_setaffinity_np(pthread_self(), sizeof(set), &set) != 0)
+    {
+        std::cerr << "Could not pin thread to cpu " << cpu << std::endl;
+    }
+#endif
+}
+
+ThreadPool::ThreadPool(int threadCount, const std::string &affinity) : nextTask(0)
+{
+    int hardwareThreads = std::max(1u, std::thread::hardware_concurrency());
+    this->threadCount = threadCount > 0 ? threadCount : hardwareThreads;
+
+    bool pin = affinity == "compact";
+    if (affinity != "none" && !pin)
+    {
+        std::cerr << "Unknown affinity " << affinity << ", threads will not be pinned" << std::endl;
+    }
+
+    // the calling thread runs as thread 0 but is left unpinned, it belongs to whoever made the pool
+    for (int i = 1; i < this->threadCount; i++)
+    {
+        workers.push_back(std::thread([this, i, pin, hardwareThreads]() {
+            if (pin)
+            {
+                pinThread(i % hardwareThreads);
+            }
+            workerLoop(i);
+        }));
+    }
+}
+
+ThreadPool::~ThreadPool()
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+    }
+    wake.notify_all();
+    for (size_t i = 0; i < workers.size(); i++)
+    {
+        workers[i].join();
+    }
+}
+
+void ThreadPool::parallelFor(int taskCount, const std::function<void(int, int)> &task)
+{
+    if (workers.empty() || taskCount <= 1)
+    {
+        for (int i = 0; i < taskCount; i++)
+        {
+            task(i, 0);
+        }
+        return;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        currentTask = &task;
+        this->taskCount = taskCount;
+        nextTask = 0;
+        busyWorkers = workers.size();
+        generation++;
+    }
+    wake.notify_all();
+
+    runTasks(0);
+
+    std::unique_lock<std::mutex> lock(mutex);
+    done.wait(lock, [this]() { return busyWorkers == 0; });
+    currentTask = nullptr;
+}
+
+void ThreadPool::workerLoop(int thread)
+{
+    int seenGeneration = 0;
+    while (true)
+    {
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            wake.wait(lock, [this, seenGeneration]() { return stopping || generation != seenGeneration; });
+            if (stopping)
+            {
+                return;
+            }
+            seenGeneration = generation;
+        }
+
+        runTasks(thread);
+
+        std::lock_guard<std::mutex> lock(mutex);
+        if (--busyWorkers == 0)
+        {
+            done.notify_one();
+        }
+    }
+}
+
+// Tasks are handed out one at a time so uneven tiles balance themselves
+void ThreadPool::runTasks(int thread)
+{
+    int index;
+    while ((index = nextTask.fetch_add(1)) < taskCount)
+    {
+        (*currentTask)(index, thread);
+    }
+}
@@ -0,0 +1,143 @@
+#include <tiledEngine.h>
+
+TiledEngine::TiledEngine(const EngineConfig &config) : pool(config.threads, config.affinity)
+{
+    kernel = selectPairKernel(config.simd);
+    // tiles have to line up with the widest kernel
+    tileSize = std::max(SIMD_WIDTH, config.tileSize / SIMD_WIDTH * SIMD_WIDTH);
+    symmetric = config.symmetric;
+    engineName = std::string(symmetric ? "tiled-symmetric-" : "tiled-") + kernel.name + " (" + std::to_string(pool.size()) + " threads, tile " + std::to_string(tileSize) + ")";
+}
+
+void TiledEngine::computeAccelerations(const std::vector<Particle> &particles, std::vector<cy::Vec3f> &acc)
+{
+    bodies.load(particles);
+    if (symmetric)
+    {
+        computeSymmetric(acc);
+        return;
+    }
+    ax.assign(bodies.paddedCount, 0);
+    ay.assign(bodies.paddedCount, 0);
+    az.assign(bodies.paddedCount, 0);
+
+    int tileCount = (bodies.paddedCount + tileSize - 1) / tileSize;
+    pool.parallelFor(tileCount, [&](int tile, int /*thread*/) {
+        int iBegin = tile * tileSize;
+        int iEnd = std::min(iBegin + tileSize, bodies.count);
+        for (int jBegin = 0; jBegin < bodies.paddedCount; jBegin += tileSize)
+        {
+            int jEnd = std::min(jBegin + tileSize, bodies.paddedCount);
+            kernel.kernel(bodies, iBegin, iEnd, jBegin, jEnd, &ax[0], &ay[0], &az[0]);
+        }
+
+        for (int i = iBegin; i < iEnd; i++)
+        {
+            float gm = GRAVITY * bodies.mass[i];
+            acc[i] = cy::Vec3f(gm * ax[i], gm * ay[i], gm * az[i]);
+        }
+    });
+    interactions += (long long)bodies.count * (bodies.count - 1);
+}
+
+void TiledEngine::computeSymmetric(std::vector<cy::Vec3f> &acc)
+{
+    int padded = bodies.paddedCount;
+    if ((int)threadForces.size() != pool.size())
+    {
+        threadForces.resize(pool.size());
+    }
+    for (size_t t = 0; t < threadForces.size(); t++)
+    {
+        threadForces[t].assign(3 * padded, 0.0f);
+    }
+
+    // every tile pair (a, b) with a <= b, the thread writes into its own buffer
+    int tileCount = (padded + tileSize - 1) / tileSize;
+    std::vector<std::pair<int, int> > tilePairs;
+    for (int a = 0; a < tileCount; a++)
+    {
+        for (int b = a; b < tileCount; b++)
+        {
+            tilePairs.push_back(std::make_pair(a, b));
+        }
+    }
+    pool.parallelFor(tilePairs.size(), [&](int task, int thread) {
+        float *forces = &threadForces[thread][0];
+        int iBegin = tilePairs[task].first * tileSize;
+        int iEnd = std::min(iBegin + tileSize, bodies.count);
+        int jBegin = tilePairs[task].second * tileSize;
+        int jEnd = std::min(jBegin + tileSize, padded);
+        kernel.symmetric(bodies, iBegin, iEnd, jBegin, jEnd, iBegin == jBegin, forces, forces + padded, forces + 2 * padded);
+    });
+
+    // reduce the thread buffers, tiles of bodies are independent
+    pool.parallelFor(tileCount, [&](int tile, int /*thread*/) {
+        int end = std::min((tile + 1) * tileSize, bodies.count);
+        for (int i = tile * tileSize; i < end; i++)
+        {
+            float fx = 0, fy = 0, fz = 0;
+            for (size_t t = 0; t < threadForces.size(); t++)
+            {
+                fx += threadForces[t][i];
+                fy += threadForces[t][padded + i];
+                fz += threadForces[t][2 * padded + i];
+            }
+            acc[i] = cy::Vec3f(GRAVITY * fx, GRAVITY * fy, GRAVITY * fz);
+        }
+    });
+
+    // counted as ordered pairs so interactions/s compares directly with the one sided mode
+    interactions += (long long)bodies.count * (bodies.count - 1);
+}
+
+// Active bodies are scattered, so each task takes a tile's worth of them and streams the j-tiles past those
+void TiledEngine::computeActiveAccelerations(const std::vector<Particle> &particles, const std::vector<int> &active, std::vector<cy::Vec3f> &acc)
+{
+    bodies.load(particles);
+    ax.resize(bodies.paddedCount);
+    ay.resize(bodies.paddedCount);
+    az.resize(bodies.paddedCount);
+
+    int count = active.size();
+    int taskCount = (count + tileSize - 1) / tileSize;
+    pool.parallelFor(taskCount, [&](int task, int /*thread*/) {
+        int begin = task * tileSize;
+        int end = std::min(begin + tileSize, count);
+        for (int a = begin; a < end; a++)
+        {
+            int i = active[a];
+            ax[i] = ay[i] = az[i] = 0;
+        }
+        for (int jBegin = 0; jBegin < bodies.paddedCount; jBegin += tileSize)
+        {
+            int jEnd = std::min(jBegin + tileSize, bodies.paddedCount);
+            for (int a = begin; a < end; a++)
+            {
+                kernel.kernel(bodies, active[a], active[a] + 1, jBegin, jEnd, &ax[0], &ay[0], &az[0]);
+            }
+        }
+        for (int a = begin; a < end; a++)
+        {
+            int i = active[a];
+            float gm = GRAVITY * bodies.mass[i];
+            acc[i] = cy::Vec3f(gm * ax[i], gm * ay[i], gm * az[i]);
+        }
+    });
+    interactions += (long long)count * (bodies.count - 1);
+}
+
+// The same direct sum as the default, split into tiles of bodies across the pool
+void TiledEngine::computeAccelerationsAndJerks(const std::vector<Particle> &particles, std::vector<cy::Vec3f> &acc, std::vector<cy::Vec3f> &jerk)
+{
+    int count = particles.size();
+    int taskCount = (count + tileSize - 1) / tileSize;
+    pool.parallelFor(taskCount, [&](int task, int /*thread*/) {
+        int end = std::min((task + 1) * tileSize, count);
+        for (int id = task * tileSize; id < end; id++)
+        {
+            calcAccelerationAndJerk(particles, id, acc[id], jerk[id]);
+        }
+    });
+    interactions += (long long)count * (count - 1);
+}
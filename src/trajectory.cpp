@@ -0,0 +1,808 @@
+#include <trajectory.h>
+#include <lodepng.h>
+#include <algorithm>
+#include <iostream>
+#include <sstream>
+#include <float.h>
+#include <math.h>
+#include <string.h>
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+static size_t roundUp(size_t value, size_t alignment)
+{
+    return (value + alignment - 1) / alignment * alignment;
+}
+
+// long is 32 bits on windows, so offsets past 2GB need the 64 bit calls
+static int seekFile(FILE *file, long long offset, int origin)
+{
+#ifdef _WIN32
+    return _fseeki64(file, offset, origin);
+#else
+    return fseeko(file, (off_t)offset, origin);
+#endif
+}
+
+static long long tellFile(FILE *file)
+{
+#ifdef _WIN32
+    return _ftelli64(file);
+#else
+    return ftello(file);
+#endif
+}
+
+TrajectoryWriter::TrajectoryWriter(const std::string &path, int bodyCount) : framesDone(0), bytesDone(0)
+{
+    this->bodyCount = bodyCount;
+    file = fopen(path.c_str(), "wb");
+    if (file == nullptr)
+    {
+        std::cerr << "Could not open " << path << " for writing, the trajectory will not be recorded" << std::endl;
+    }
+}
+
+TrajectoryWriter::~TrajectoryWriter()
+{
+    close();
+}
+
+void TrajectoryWriter::start()
+{
+    if (file != nullptr)
+    {
+        worker = std::thread(&TrajectoryWriter::writerLoop, this);
+    }
+}
+
+void TrajectoryWriter::close()
+{
+    if (worker.joinable())
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stopping = true;
+        }
+        wake.notify_one();
+        worker.join();
+    }
+    if (file != nullptr)
+    {
+        fclose(file);
+        file = nullptr;
+    }
+}
+
+void TrajectoryWriter::append(int step, const std::vector<Particle> &particles, const std::vector<int> &bodyIds)
+{
+    if (!worker.joinable())
+    {
+        return;
+    }
+    TrajectoryFrame frame;
+    frame.step = step;
+    frame.fields.resize((size_t)FIELD_COUNT * bodyCount);
+    float *fields[FIELD_COUNT];
+    for (int f = 0; f < FIELD_COUNT; f++)
+    {
+        fields[f] = &frame.fields[(size_t)bodyCount * f];
+    }
+    for (size_t slot = 0; slot < particles.size(); slot++)
+    {
+        int body = bodyIds.empty() ? slot : bodyIds[slot];
+        const Particle &p = particles[slot];
+        fields[FIELD_X][body] = p.pos.x;
+        fields[FIELD_Y][body] = p.pos.y;
+        fields[FIELD_Z][body] = p.pos.z;
+        fields[FIELD_VX][body] = p.vel.x;
+        fields[FIELD_VY][body] = p.vel.y;
+        fields[FIELD_VZ][body] = p.vel.z;
+        fields[FIELD_MASS][body] = p.mass();
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (stopping)
+        {
+            return;
+        }
+        pending.push_back(std::move(frame));
+    }
+    wake.notify_one();
+}
+
+void TrajectoryWriter::writeBytes(const void *data, size_t bytes)
+{
+    if (fwrite(data, 1, bytes, file) != bytes)
+    {
+        std::cerr << "Could not write trajectory frame" << std::endl;
+    }
+    bytesDone += bytes;
+}
+
+void TrajectoryWriter::writerLoop()
+{
+    std::vector<TrajectoryFrame> frames;
+    while (true)
+    {
+        bool last;
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            wake.wait(lock, [this] { return stopping || !pending.empty(); });
+            frames.assign(std::make_move_iterator(pending.begin()), std::make_move_iterator(pending.end()));
+            pending.clear();
+            last = stopping;
+        }
+
+        if (!frames.empty())
+        {
+            write(frames);
+            // readers of a run still in progress see every frame handed to the file
+            fflush(file);
+        }
+        if (last)
+        {
+            flush();
+            return;
+        }
+    }
+}
+
+RawTrajectoryWriter::RawTrajectoryWriter(const std::string &path, int bodyCount, float dt) : TrajectoryWriter(path, bodyCount)
+{
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, TRAJECTORY_MAGIC, sizeof(header.magic));
+    header.version = TRAJECTORY_VERSION;
+    header.bodyCount = bodyCount;
+    header.fieldCount = FIELD_COUNT;
+    header.fieldBytes = roundUp(sizeof(float) * bodyCount, TRAJECTORY_ARRAY_ALIGNMENT);
+    header.headerBytes = TRAJECTORY_PAGE;
+    header.frameBytes = roundUp(sizeof(TrajectoryFrameHeader) + (size_t)header.fieldBytes * FIELD_COUNT, TRAJECTORY_PAGE);
+    header.dt = dt;
+
+    if (file != nullptr)
+    {
+        std::vector<unsigned char> page(header.headerBytes, 0);
+        memcpy(&page[0], &header, sizeof(header));
+        writeBytes(&page[0], page.size());
+        frameBuffer.resize(header.frameBytes, 0);
+    }
+    start();
+}
+
+RawTrajectoryWriter::~RawTrajectoryWriter()
+{
+    close();
+}
+
+void RawTrajectoryWriter::write(std::vector<TrajectoryFrame> &frames)
+{
+    for (size_t i = 0; i < frames.size(); i++)
+    {
+        // the padding stays zero from the first frame on
+        TrajectoryFrameHeader *frameHeader = (TrajectoryFrameHeader *)&frameBuffer[0];
+        frameHeader->step = frames[i].step;
+        for (int f = 0; f < FIELD_COUNT; f++)
+        {
+            memcpy(&frameBuffer[sizeof(TrajectoryFrameHeader) + (size_t)header.fieldBytes * f],
+                   &frames[i].fields[(size_t)bodyCount * f], sizeof(float) * bodyCount);
+        }
+        writeBytes(&frameBuffer[0], frameBuffer.size());
+        framesDone++;
+    }
+}
+
+// Guess of a float's bits from the same value in the two frames before, a straight line
+// through them once there are two. Floats of one sign order like their bits, so this
+// extrapolates the value itself.
+static uint32_t predictBits(const uint32_t *previous, const uint32_t *beforePrevious, size_t word)
+{
+    if (previous == nullptr)
+    {
+        return 0;
+    }
+    if (beforePrevious == nullptr)
+    {
+        return previous[word];
+    }
+    return 2 * previous[word] - beforePrevious[word];
+}
+
+// Small residuals of either sign become small unsigned numbers, so their high bytes are zero
+static uint32_t zigzag(uint32_t residual)
+{
+    return (residual << 1) ^ (uint32_t)((int32_t)residual >> 31);
+}
+
+static uint32_t unzigzag(uint32_t bits)
+{
+    return (bits >> 1) ^ (0u - (bits & 1));
+}
+
+// Stores each word as its difference from predictBits and splits each field array into its
+// four byte planes, so the bytes that barely change between frames end up next to each other.
+// words holds count frames of FIELD_COUNT arrays.
+static void encodeWords(const std::vector<uint32_t> &words, size_t count, int bodyCount, std::vector<unsigned char> &out)
+{
+    size_t arrayBytes = sizeof(float) * bodyCount;
+    size_t frameWords = (size_t)FIELD_COUNT * bodyCount;
+    out.resize(count * FIELD_COUNT * arrayBytes);
+    for (size_t f = 0; f < count; f++)
+    {
+        const uint32_t *current = &words[f * frameWords];
+        const uint32_t *previous = f > 0 ? current - frameWords : nullptr;
+        const uint32_t *beforePrevious = f > 1 ? current - 2 * frameWords : nullptr;
+        for (int field = 0; field < FIELD_COUNT; field++)
+        {
+            size_t base = (f * FIELD_COUNT + field) * arrayBytes;
+            for (int i = 0; i < bodyCount; i++)
+            {
+                size_t word = (size_t)field * bodyCount + i;
+                uint32_t bits = zigzag(current[word] - predictBits(previous, beforePrevious, word));
+                out[base + i] = bits;
+                out[base + bodyCount + i] = bits >> 8;
+                out[base + 2 * bodyCount + i] = bits >> 16;
+                out[base + 3 * bodyCount + i] = bits >> 24;
+            }
+        }
+    }
+}
+
+// Inverse of encodeWords
+static void decodeWords(const std::vector<unsigned char> &in, size_t count, int bodyCount, uint32_t *words)
+{
+    size_t arrayBytes = sizeof(float) * bodyCount;
+    size_t frameWords = (size_t)FIELD_COUNT * bodyCount;
+    for (size_t f = 0; f < count; f++)
+    {
+        uint32_t *current = words + f * frameWords;
+        const uint32_t *previous = f > 0 ? current - frameWords : nullptr;
+        const uint32_t *beforePrevious = f > 1 ? current - 2 * frameWords : nullptr;
+        for (int field = 0; field < FIELD_COUNT; field++)
+        {
+            size_t base = (f * FIELD_COUNT + field) * arrayBytes;
+            for (int i = 0; i < bodyCount; i++)
+            {
+                size_t word = (size_t)field * bodyCount + i;
+                uint32_t bits = in[base + i] | (in[base + bodyCount + i] << 8) | (in[base + 2 * bodyCount + i] << 16) |
+                                ((uint32_t)in[base + 3 * bodyCount + i] << 24);
+                current[word] = unzigzag(bits) + predictBits(previous, beforePrevious, word);
+            }
+        }
+    }
+}
+
+// Worked in double so the only rounding is the final one to float
+static uint32_t quantize(float value, const ChunkQuantization &grid)
+{
+    return (uint32_t)(int32_t)lrint(((double)value - grid.origin) / grid.quantum);
+}
+
+static float dequantize(uint32_t q, const ChunkQuantization &grid)
+{
+    return grid.origin + (double)(int32_t)q * grid.quantum;
+}
+
+TrajectoryFieldGroup fieldGroup(int field)
+{
+    if (field <= FIELD_Z)
+    {
+        return GROUP_POSITION;
+    }
+    return field <= FIELD_VZ ? GROUP_VELOCITY : GROUP_MASS;
+}
+
+bool parseFieldGroups(const std::string &list, uint32_t &fields)
+{
+    static const char *GROUP_NAMES[GROUP_COUNT] = {"position", "velocity", "mass"};
+    fields = 0;
+    size_t start = 0;
+    while (start < list.size())
+    {
+        size_t end = list.find(',', start);
+        std::string name = list.substr(start, end == std::string::npos ? std::string::npos : end - start);
+        int group = 0;
+        while (group < GROUP_COUNT && name != GROUP_NAMES[group])
+        {
+            group++;
+        }
+        if (group == GROUP_COUNT)
+        {
+            return false;
+        }
+        for (int field = 0; field < FIELD_COUNT; field++)
+        {
+            if (fieldGroup(field) == group)
+            {
+                fields |= 1u << field;
+            }
+        }
+        start = end == std::string::npos ? list.size() : end + 1;
+    }
+    return true;
+}
+
+// Fills words with frames [first, first + count) as bits, lossy fields as their index on a grid
+// just under twice the bound, which is errorBound times the extent of the field group over the
+// chunk. bounds gets the bound of each group, errors the largest error of each frame and group.
+static void quantizeFrames(const std::vector<TrajectoryFrame> &frames, size_t first, size_t count, int bodyCount,
+                           uint32_t lossyFields, float errorBound, std::vector<uint32_t> &words,
+                           ChunkQuantization grid[FIELD_COUNT], float bounds[GROUP_COUNT], std::vector<float> &errors)
+{
+    size_t frameWords = (size_t)FIELD_COUNT * bodyCount;
+    words.resize(count * frameWords);
+    errors.assign(count * GROUP_COUNT, 0);
+
+    float minimum[FIELD_COUNT], maximum[FIELD_COUNT], extent[GROUP_COUNT] = {0}, magnitude[GROUP_COUNT] = {0};
+    for (int field = 0; field < FIELD_COUNT; field++)
+    {
+        minimum[field] = maximum[field] = frames[first].fields[(size_t)field * bodyCount];
+        for (size_t f = 0; f < count && (lossyFields >> field & 1); f++)
+        {
+            const float *values = &frames[first + f].fields[(size_t)field * bodyCount];
+            for (int i = 0; i < bodyCount; i++)
+            {
+                minimum[field] = std::min(minimum[field], values[i]);
+                maximum[field] = std::max(maximum[field], values[i]);
+            }
+        }
+        int group = fieldGroup(field);
+        extent[group] = std::max(extent[group], maximum[field] - minimum[field]);
+        magnitude[group] = std::max(magnitude[group], std::max(fabsf(minimum[field]), fabsf(maximum[field])));
+    }
+    for (int group = 0; group < GROUP_COUNT; group++)
+    {
+        bounds[group] = errorBound * extent[group];
+    }
+
+    for (int field = 0; field < FIELD_COUNT; field++)
+    {
+        grid[field].origin = 0;
+        grid[field].quantum = 0;
+        if (!(lossyFields >> field & 1))
+        {
+            memcpy(&words[(size_t)field * bodyCount], &frames[first].fields[(size_t)field * bodyCount], sizeof(float) * bodyCount);
+            for (size_t f = 1; f < count; f++)
+            {
+                memcpy(&words[f * frameWords + (size_t)field * bodyCount], &frames[first + f].fields[(size_t)field * bodyCount], sizeof(float) * bodyCount);
+            }
+            continue;
+        }
+
+        int group = fieldGroup(field);
+        // leave room for rounding the value back to float, a field that never changes is exact
+        // on any grid, and indices have to fit 31 bits
+        float quantum = std::max(2 * (bounds[group] - magnitude[group] * FLT_EPSILON), extent[group] / (1 << 30));
+        grid[field].origin = minimum[field];
+        grid[field].quantum = quantum > 0 ? quantum : 1;
+        for (size_t f = 0; f < count; f++)
+        {
+            const float *values = &frames[first + f].fields[(size_t)field * bodyCount];
+            uint32_t *q = &words[f * frameWords + (size_t)field * bodyCount];
+            float &error = errors[f * GROUP_COUNT + group];
+            for (int i = 0; i < bodyCount; i++)
+            {
+                q[i] = quantize(values[i], grid[field]);
+                error = std::max(error, fabsf(values[i] - dequantize(q[i], grid[field])));
+            }
+        }
+    }
+}
+
+CompressedTrajectoryWriter::CompressedTrajectoryWriter(const std::string &path, int bodyCount, float dt, const TrajectoryConfig &config)
+    : TrajectoryWriter(path, bodyCount), pool(config.threads, "none")
+{
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, COMPRESSED_TRAJECTORY_MAGIC, sizeof(header.magic));
+    header.version = COMPRESSED_TRAJECTORY_VERSION;
+    header.bodyCount = bodyCount;
+    header.fieldCount = FIELD_COUNT;
+    header.chunkFrames = std::max(1, config.chunkFrames);
+    header.dt = dt;
+    header.lossyFields = config.lossyFields & ((1u << FIELD_COUNT) - 1);
+    header.errorBound = config.errorBound;
+
+    if (file != nullptr)
+    {
+        writeBytes(&header, sizeof(header));
+    }
+    start();
+}
+
+CompressedTrajectoryWriter::~CompressedTrajectoryWriter()
+{
+    close();
+}
+
+void CompressedTrajectoryWriter::write(std::vector<TrajectoryFrame> &frames)
+{
+    for (size_t i = 0; i < frames.size(); i++)
+    {
+        chunkFrames.push_back(std::move(frames[i]));
+    }
+    writeChunks(false);
+}
+
+void CompressedTrajectoryWriter::flush()
+{
+    writeChunks(true);
+}
+
+void CompressedTrajectoryWriter::writeChunks(bool partial)
+{
+    size_t chunkSize = header.chunkFrames;
+    size_t chunks = partial ? (chunkFrames.size() + chunkSize - 1) / chunkSize : chunkFrames.size() / chunkSize;
+    if (chunks == 0)
+    {
+        return;
+    }
+
+    // every chunk stands on its own, so they compress in parallel and are written in order
+    std::vector<std::vector<unsigned char> > compressed(chunks);
+    std::vector<std::vector<ChunkQuantization> > grids(chunks, std::vector<ChunkQuantization>(FIELD_COUNT));
+    std::vector<std::vector<float> > errors(chunks);
+    std::vector<std::vector<float> > bounds(chunks, std::vector<float>(GROUP_COUNT));
+    std::vector<unsigned> failures(chunks);
+    pool.parallelFor(chunks, [&](int chunk, int /*thread*/) {
+        size_t first = chunk * chunkSize;
+        size_t count = std::min(chunkSize, chunkFrames.size() - first);
+        std::vector<uint32_t> words;
+        std::vector<unsigned char> encoded;
+        quantizeFrames(chunkFrames, first, count, bodyCount, header.lossyFields, header.errorBound, words, &grids[chunk][0], &bounds[chunk][0], errors[chunk]);
+        encodeWords(words, count, bodyCount, encoded);
+        failures[chunk] = lodepng::compress(compressed[chunk], encoded);
+    });
+
+    for (size_t chunk = 0; chunk < chunks; chunk++)
+    {
+        size_t first = chunk * chunkSize;
+        size_t count = std::min(chunkSize, chunkFrames.size() - first);
+        if (failures[chunk] != 0)
+        {
+            // a whole chunk is left out, so every chunk before the last stays full for the reader
+            std::cerr << "Could not compress trajectory steps " << chunkFrames[first].step << " to " << chunkFrames[first + count - 1].step
+                      << ": " << lodepng_error_text(failures[chunk]) << ", they are not recorded" << std::endl;
+            continue;
+        }
+        CompressedChunkHeader chunkHeader;
+        memset(&chunkHeader, 0, sizeof(chunkHeader));
+        chunkHeader.frameCount = count;
+        chunkHeader.compressedBytes = compressed[chunk].size();
+        std::vector<int64_t> steps(count);
+        for (size_t f = 0; f < count; f++)
+        {
+            steps[f] = chunkFrames[first + f].step;
+        }
+        long long before = bytesDone;
+        writeBytes(&chunkHeader, sizeof(chunkHeader));
+        writeBytes(&steps[0], sizeof(int64_t) * count);
+        if (header.lossyFields != 0)
+        {
+            writeBytes(&grids[chunk][0], sizeof(ChunkQuantization) * FIELD_COUNT);
+        }
+        writeBytes(&compressed[chunk][0], compressed[chunk].size());
+        framesDone += count;
+
+        if (header.lossyFields == 0)
+        {
+            continue;
+        }
+        // the frames of a chunk are compressed together, so they share its ratio
+        static const char *GROUP_NAMES[GROUP_COUNT] = {"position", "velocity", "mass"};
+        double ratio = (double)count * FIELD_COUNT * bodyCount * sizeof(float) / (bytesDone - before);
+        for (size_t f = 0; f < count; f++)
+        {
+            std::ostringstream line;
+            line << "trajectory step " << steps[f] << ": " << ratio << "x";
+            for (int group = 0; group < GROUP_COUNT; group++)
+            {
+                for (int field = 0; field < FIELD_COUNT; field++)
+                {
+                    if (fieldGroup(field) == group && (header.lossyFields >> field & 1))
+                    {
+                        line << ", " << GROUP_NAMES[group] << " error " << errors[chunk][f * GROUP_COUNT + group]
+                             << " (bound " << bounds[chunk][group] << ")";
+                        break;
+                    }
+                }
+            }
+            std::cout << line.str() << std::endl;
+        }
+    }
+    chunkFrames.erase(chunkFrames.begin(), chunkFrames.begin() + std::min(chunkFrames.size(), chunks * chunkSize));
+}
+
+TrajectoryWriter *createTrajectoryWriter(const TrajectoryConfig &config, const std::string &path, int bodyCount, float dt)
+{
+    if (config.format == "raw")
+    {
+        return new RawTrajectoryWriter(path, bodyCount, dt);
+    }
+    if (config.format == "deflate")
+    {
+        return new CompressedTrajectoryWriter(path, bodyCount, dt, config);
+    }
+    return nullptr;
+}
+
+TrajectoryFile::~TrajectoryFile()
+{
+    close();
+}
+
+void TrajectoryFile::close()
+{
+    if (data == nullptr)
+    {
+        return;
+    }
+#ifdef _WIN32
+    UnmapViewOfFile(data);
+    CloseHandle((HANDLE)mappingHandle);
+    CloseHandle((HANDLE)fileHandle);
+#else
+    munmap((void *)data, size);
+#endif
+    data = nullptr;
+    header = nullptr;
+}
+
+bool TrajectoryFile::open(const std::string &path)
+{
+    close();
+#ifdef _WIN32
+    HANDLE file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+    LARGE_INTEGER fileSize;
+    if (file == INVALID_HANDLE_VALUE || !GetFileSizeEx(file, &fileSize) || fileSize.QuadPart < (LONGLONG)sizeof(TrajectoryHeader))
+    {
+        std::cerr << "Could not open trajectory " << path << std::endl;
+        if (file != INVALID_HANDLE_VALUE)
+        {
+            CloseHandle(file);
+        }
+        return false;
+    }
+    HANDLE mapping = CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL);
+    const void *view = mapping != NULL ? MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0) : NULL;
+    if (view == NULL)
+    {
+        std::cerr << "Could not map trajectory " << path << std::endl;
+        if (mapping != NULL)
+        {
+            CloseHandle(mapping);
+        }
+        CloseHandle(file);
+        return false;
+    }
+    fileHandle = file;
+    mappingHandle = mapping;
+    data = (const unsigned char *)view;
+    size = fileSize.QuadPart;
+#else
+    int fd = ::open(path.c_str(), O_RDONLY);
+    struct stat info;
+    if (fd < 0 || fstat(fd, &info) != 0 || info.st_size < (off_t)sizeof(TrajectoryHeader))
+    {
+        std::cerr << "Could not open trajectory " << path << std::endl;
+        if (fd >= 0)
+        {
+            ::close(fd);
+        }
+        return false;
+    }
+    void *view = mmap(nullptr, info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    // the mapping keeps the file alive
+    ::close(fd);
+    if (view == MAP_FAILED)
+    {
+        std::cerr << "Could not map trajectory " << path << std::endl;
+        return false;
+    }
+    data = (const unsigned char *)view;
+    size = info.st_size;
+#endif
+
+    header = (const TrajectoryHeader *)data;
+    if (memcmp(header->magic, TRAJECTORY_MAGIC, sizeof(header->magic)) != 0 || header->version != TRAJECTORY_VERSION ||
+        header->fieldCount != FIELD_COUNT || header->frameBytes == 0 || header->headerBytes > size)
+    {
+        std::cerr << path << " is not a trajectory this build can read" << std::endl;
+        close();
+        return false;
+    }
+    frames = (size - header->headerBytes) / header->frameBytes;
+    return true;
+}
+
+int64_t TrajectoryFile::step(long long frame) const
+{
+    const unsigned char *start = data + header->headerBytes + header->frameBytes * frame;
+    return ((const TrajectoryFrameHeader *)start)->step;
+}
+
+const float *TrajectoryFile::field(long long frame, TrajectoryField field) const
+{
+    const unsigned char *start = data + header->headerBytes + header->frameBytes * frame;
+    return (const float *)(start + sizeof(TrajectoryFrameHeader) + (size_t)header->fieldBytes * field);
+}
+
+void TrajectoryFile::readFrame(long long frame, std::vector<Particle> &particles) const
+{
+    int count = bodyCount();
+    const float *fields[FIELD_COUNT];
+    for (int f = 0; f < FIELD_COUNT; f++)
+    {
+        fields[f] = field(frame, (TrajectoryField)f);
+    }
+    particles.resize(count);
+    for (int i = 0; i < count; i++)
+    {
+        particles[i].pos = cy::Vec4f(fields[FIELD_X][i], fields[FIELD_Y][i], fields[FIELD_Z][i], fields[FIELD_MASS][i]);
+        particles[i].vel = cy::Vec4f(fields[FIELD_VX][i], fields[FIELD_VY][i], fields[FIELD_VZ][i], 0);
+    }
+}
+
+CompressedTrajectoryFile::~CompressedTrajectoryFile()
+{
+    if (file != nullptr)
+    {
+        fclose(file);
+    }
+}
+
+bool CompressedTrajectoryFile::open(const std::string &path)
+{
+    file = fopen(path.c_str(), "rb");
+    if (file == nullptr || fread(&header, sizeof(header), 1, file) != 1)
+    {
+        std::cerr << "Could not open trajectory " << path << std::endl;
+        return false;
+    }
+    if (memcmp(header.magic, COMPRESSED_TRAJECTORY_MAGIC, sizeof(header.magic)) != 0 ||
+        header.version != COMPRESSED_TRAJECTORY_VERSION || header.fieldCount != FIELD_COUNT || header.chunkFrames == 0)
+    {
+        std::cerr << path << " is not a trajectory this build can read" << std::endl;
+        return false;
+    }
+
+    // walk the chunk headers once, a chunk cut short by a crash ends the file
+    seekFile(file, 0, SEEK_END);
+    long long size = tellFile(file);
+    long long offset = sizeof(header);
+    CompressedChunkHeader chunkHeader;
+    while (seekFile(file, offset, SEEK_SET) == 0 && fread(&chunkHeader, sizeof(chunkHeader), 1, file) == 1)
+    {
+        long long end = offset + sizeof(chunkHeader) + sizeof(int64_t) * chunkHeader.frameCount + gridBytes() + chunkHeader.compressedBytes;
+        if (chunkHeader.frameCount == 0 || chunkHeader.frameCount > header.chunkFrames || end > size)
+        {
+            break;
+        }
+        size_t first = steps.size();
+        steps.resize(first + chunkHeader.frameCount);
+        if (fread(&steps[first], sizeof(int64_t), chunkHeader.frameCount, file) != chunkHeader.frameCount)
+        {
+            steps.resize(first);
+            break;
+        }
+        chunkOffsets.push_back(offset);
+        offset = end;
+        // only the last chunk may be short, so frame / chunkFrames finds the chunk of a frame
+        if (chunkHeader.frameCount < header.chunkFrames)
+        {
+            break;
+        }
+    }
+    frames = steps.size();
+    return true;
+}
+
+int64_t CompressedTrajectoryFile::step(long long frame) const
+{
+    return steps[frame];
+}
+
+bool CompressedTrajectoryFile::decodeChunk(long long chunk)
+{
+    if (chunk == decodedChunk)
+    {
+        return true;
+    }
+    CompressedChunkHeader chunkHeader;
+    if (seekFile(file, chunkOffsets[chunk], SEEK_SET) != 0 || fread(&chunkHeader, sizeof(chunkHeader), 1, file) != 1)
+    {
+        return false;
+    }
+    ChunkQuantization grid[FIELD_COUNT];
+    std::vector<unsigned char> compressed(chunkHeader.compressedBytes);
+    std::vector<unsigned char> encoded;
+    if (seekFile(file, sizeof(int64_t) * chunkHeader.frameCount, SEEK_CUR) != 0 ||
+        fread(grid, 1, gridBytes(), file) != gridBytes() || fread(&compressed[0], 1, compressed.size(), file) != compressed.size() ||
+        lodepng::decompress(encoded, compressed) != 0 ||
+        encoded.size() != (size_t)chunkHeader.frameCount * FIELD_COUNT * header.bodyCount * sizeof(float))
+    {
+        std::cerr << "Trajectory chunk " << chunk << " is damaged" << std::endl;
+        return false;
+    }
+    int count = header.bodyCount;
+    size_t frameWords = (size_t)FIELD_COUNT * count;
+    decoded.resize(chunkHeader.frameCount * frameWords);
+    uint32_t *words = (uint32_t *)&decoded[0];
+    decodeWords(encoded, chunkHeader.frameCount, count, words);
+    for (size_t f = 0; f < chunkHeader.frameCount; f++)
+    {
+        for (int field = 0; field < FIELD_COUNT; field++)
+        {
+            if (!(header.lossyFields >> field & 1))
+            {
+                continue;
+            }
+            float *values = &decoded[f * frameWords + (size_t)field * count];
+            for (int i = 0; i < count; i++)
+            {
+                values[i] = dequantize(words[f * frameWords + (size_t)field * count + i], grid[field]);
+            }
+        }
+    }
+    decodedChunk = chunk;
+    return true;
+}
+
+bool CompressedTrajectoryFile::readFrame(long long frame, std::vector<Particle> &particles)
+{
+    if (!decodeChunk(frame / header.chunkFrames))
+    {
+        return false;
+    }
+    int count = bodyCount();
+    const float *fields = &decoded[(size_t)(frame % header.chunkFrames) * FIELD_COUNT * count];
+    particles.resize(count);
+    for (int i = 0; i < count; i++)
+    {
+        particles[i].pos = cy::Vec4f(fields[FIELD_X * count + i], fields[FIELD_Y * count + i], fields[FIELD_Z * count + i], fields[FIELD_MASS * count + i]);
+        particles[i].vel = cy::Vec4f(fields[FIELD_VX * count + i], fields[FIELD_VY * count + i], fields[FIELD_VZ * count + i], 0);
+    }
+    return true;
+}
+
+bool readTrajectoryFrame(const std::string &path, long long frame, std::vector<Particle> &particles, int64_t &step)
+{
+    char magic[8] = {0};
+    FILE *probe = fopen(path.c_str(), "rb");
+    if (probe == nullptr)
+    {
+        std::cerr << "Could not open trajectory " << path << std::endl;
+        return false;
+    }
+    size_t magicBytes = fread(magic, 1, sizeof(magic), probe);
+    fclose(probe);
+    bool compressed = magicBytes == sizeof(magic) && memcmp(magic, COMPRESSED_TRAJECTORY_MAGIC, sizeof(magic)) == 0;
+
+    TrajectoryFile raw;
+    CompressedTrajectoryFile deflated;
+    if (compressed ? !deflated.open(path) : !raw.open(path))
+    {
+        return false;
+    }
+    long long frames = compressed ? deflated.frameCount() : raw.frameCount();
+    long long index = frame < 0 ? frames + frame : frame;
+    if (index < 0 || index >= frames)
+    {
+        std::cerr << path << " has " << frames << " frames, there is no frame " << frame << std::endl;
+        return false;
+    }
+    if (compressed)
+    {
+        step = deflated.step(index);
+        return deflated.readFrame(index, particles);
+    }
+    step = raw.step(index);
+    raw.readFrame(index, particles);
+    return true;
+}